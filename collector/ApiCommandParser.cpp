@@ -32,6 +32,7 @@ ApiCommandParser::ApiCommandParser(EmsCommandSender& sender,
 				   ValueCache *cache,
 				   OutputCallback outputCb,
 				   boost::asio::io_service& ios) :
+    m_ios(ios),
     m_sender(sender),
     m_client(client),
     m_cache(cache),
@@ -39,6 +40,7 @@ ApiCommandParser::ApiCommandParser(EmsCommandSender& sender,
     m_responseCounter(0),
     m_parsePosition(0),
     m_outputRawData(false),
+    m_answeredFromCache(false),
     testModeRepeater(ios)
     
 {
@@ -76,6 +78,7 @@ ApiCommandParser::parse(std::istream& request)
 		"raw\n"
 #endif
 		"cache\n"
+		"priority interactive|background\n"
 		"getversion\n"
 		"OK");
 	return Ok;
@@ -99,6 +102,8 @@ ApiCommandParser::parse(std::istream& request)
 #endif
     } else if (category == "cache") {
 	return handleCacheCommand(request);
+    } else if (category == "priority") {
+	return handlePriorityCommand(request);
     } else if (category == "getversion") {
 	output("collector version: " API_VERSION);
 	startRequest(EmsProto::addressUBA2, 0x02, 0, 3);
@@ -108,6 +113,25 @@ ApiCommandParser::parse(std::istream& request)
     return InvalidCmd;
 }
 
+ApiCommandParser::CommandResult
+ApiCommandParser::handlePriorityCommand(std::istream& request)
+{
+    std::string priority;
+    request >> priority;
+
+    /* scripts and bulk dumps shouldn't delay other users' commands */
+    if (priority == "interactive") {
+	m_client->setPriority(EmsCommandClient::Interactive);
+    } else if (priority == "background") {
+	m_client->setPriority(EmsCommandClient::Background);
+    } else {
+	return InvalidArgs;
+    }
+
+    output("OK");
+    return Ok;
+}
+
 ApiCommandParser::CommandResult
 ApiCommandParser::handleRcCommand(std::istream& request)
 {
@@ -521,8 +545,40 @@ ApiCommandParser::handleCacheCommand(std::istream& request)
 	if (cmd == "help") {
 	    output("Available subcommands:\n"
 		   "fetch <key>\n"
+		   "history <key> [<count>|since <timestamp>]\n"
 		   "OK");
 	    return Ok;
+	} else if (cmd == "history") {
+	    std::ostringstream stream;
+	    std::vector<std::string> selector;
+	    size_t count = 0;
+	    time_t since = 0;
+
+	    while (request) {
+		std::string token;
+		request >> token;
+		if (!token.empty()) {
+		    selector.push_back(token);
+		}
+	    }
+
+	    try {
+		size_t size = selector.size();
+		if (size >= 2 && selector[size - 2] == "since") {
+		    since = boost::lexical_cast<time_t>(selector[size - 1]);
+		    selector.resize(size - 2);
+		} else if (size >= 1 && isdigit(selector[size - 1][0])) {
+		    count = boost::lexical_cast<size_t>(selector[size - 1]);
+		    selector.resize(size - 1);
+		}
+	    } catch (boost::bad_lexical_cast& e) {
+		return InvalidArgs;
+	    }
+
+	    m_cache->outputHistory(selector, count, since, stream);
+	    output(stream.str());
+	    output("OK");
+	    return Ok;
 	} else if (cmd == "fetch") {
 	    std::ostringstream stream;
 	    std::vector<std::string> selector;
@@ -775,7 +831,7 @@ ApiCommandParser::onIncomingMessage(const EmsMessage& message)
     }
 
 
-    const std::vector<uint8_t>& data = message.getData();
+    const EmsMessage::Payload& data = message.getData();
     uint8_t source = message.getSource();
     uint16_t type = message.getType();
     uint8_t offset = message.getOffset();
@@ -792,6 +848,11 @@ ApiCommandParser::onIncomingMessage(const EmsMessage& message)
 	return boost::indeterminate;
     }
 
+    if (!m_answeredFromCache) {
+	m_sender.responseCache().store(m_requestDestination, m_requestType, offset,
+				       m_activeRequest->getData()[0], data);
+    }
+
 
     if (data.empty()) {
 	// no more data is available
@@ -1207,11 +1268,47 @@ ApiCommandParser::continueRequest()
 
     uint8_t offset = (uint8_t) (m_requestOffset + alreadyReceived);
     uint8_t remaining = (uint8_t) (m_requestLength - alreadyReceived);
+    std::vector<uint8_t> cached;
+
+    if (m_sender.responseCache().lookup(m_requestDestination, m_requestType,
+					offset, remaining, cached)) {
+	m_activeRequest.reset(new EmsMessage(m_requestDestination, m_requestType,
+					     offset, std::vector<uint8_t>(1, remaining), true));
+	m_answeredFromCache = true;
+	answerFromCache(cached);
+	return true;
+    }
 
     sendCommand(m_requestDestination, m_requestType, offset, &remaining, 1, true);
     return true;
 }
 
+void
+ApiCommandParser::answerFromCache(const std::vector<uint8_t>& data)
+{
+    /* rebuild the response frame as it came from the bus */
+    std::vector<uint8_t> frame;
+    frame.push_back(m_requestDestination);
+    frame.push_back(EmsProto::addressPC & 0x7f);
+    frame.push_back(m_requestType < 0xf0 ? m_requestType : 0xff);
+    frame.push_back(m_activeRequest->getOffset());
+    if (m_requestType >= 0xf0) {
+	frame.push_back(m_requestType >> 8);
+	frame.push_back(m_requestType & 0xff);
+    }
+    frame.insert(frame.end(), data.begin(), data.end());
+
+    /* answer asynchronously like the bus would, the caller may not
+     * expect the response before the request call returned */
+    boost::shared_ptr<EmsCommandClient> client = m_client;
+    m_ios.post([client, frame] () mutable {
+	static const EmsMessage::ValueHandler noValueHandler;
+	static const EmsMessage::CacheAccessor noCacheAccessor;
+	EmsMessage message(noValueHandler, noCacheAccessor, frame.data(), frame.size());
+	client->onIncomingMessage(message);
+    });
+}
+
 void
 ApiCommandParser::sendCommand(uint8_t dest, uint16_t type, uint8_t offset,
 			       const uint8_t *data, size_t count,
@@ -1220,6 +1317,7 @@ ApiCommandParser::sendCommand(uint8_t dest, uint16_t type, uint8_t offset,
     std::vector<uint8_t> sendData(data, data + count);
 
     m_retriesLeft = MaxRequestRetries;
+    m_answeredFromCache = false;
 
     DebugStream& debug = Options::messageDebug();
     debug << "New EmsMessage: dest=";
@@ -61,6 +61,7 @@ class ApiCommandParser : public boost::noncopyable
 	CommandResult handleRawCommand(std::istream& request);
 #endif
 	CommandResult handleCacheCommand(std::istream& request);
+	CommandResult handlePriorityCommand(std::istream& request);
 	CommandResult handleHkCommand(std::istream& request, uint16_t base);
 	CommandResult handleSingleByteValue(std::istream& request, uint8_t dest, uint16_t type,
 					    uint8_t offset, int multiplier, int min, int max);
@@ -78,6 +79,7 @@ class ApiCommandParser : public boost::noncopyable
 	void startRequest(uint8_t dest, uint16_t type, size_t offset, size_t length,
 			  bool newRequest = true, bool raw = false);
 	bool continueRequest();
+	void answerFromCache(const std::vector<uint8_t>& data);
 	void sendCommand(uint8_t dest, uint16_t type, uint8_t offset,
 			 const uint8_t *data, size_t count,
 			 bool expectResponse = false);
@@ -97,6 +99,7 @@ class ApiCommandParser : public boost::noncopyable
     private:
 	static const unsigned int MaxRequestRetries = 5;
 
+	boost::asio::io_service& m_ios;
 	EmsCommandSender& m_sender;
 	boost::shared_ptr<EmsCommandClient> m_client;
 	ValueCache *m_cache;
@@ -111,6 +114,8 @@ class ApiCommandParser : public boost::noncopyable
 	uint16_t m_requestType;
 	size_t m_parsePosition;
 	bool m_outputRawData;
+	/* whether the active request is answered by the response cache */
+	bool m_answeredFromCache;
 	boost::asio::deadline_timer testModeRepeater;
 };
 
@@ -0,0 +1,110 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "BusCapture.h"
+
+const char BusCapture::Magic[6] = { 'E', 'M', 'S', 'C', 'A', 'P' };
+
+BusCaptureWriter::BusCaptureWriter(const std::string& path) :
+    m_file(path.c_str(), std::ios::out | std::ios::binary | std::ios::app),
+    m_failed(false)
+{
+    if (!m_file.is_open()) {
+	std::cerr << "Could not open capture file " << path << std::endl;
+	return;
+    }
+
+    /* reconnects append to the existing capture */
+    m_file.seekp(0, std::ios::end);
+    if (m_file.tellp() == 0) {
+	m_file.write(BusCapture::Magic, sizeof(BusCapture::Magic));
+	m_file.put(BusCapture::Version);
+	m_file.flush();
+    }
+}
+
+void
+BusCaptureWriter::write(const uint8_t *data, size_t length)
+{
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+    uint64_t timestamp = (now - epoch).total_microseconds();
+    char header[BusCapture::RecordHeaderSize];
+
+    if (!m_file.is_open() || m_failed) {
+	return;
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+	header[i] = (char) (timestamp >> (8 * i));
+    }
+    header[8] = (char) (length & 0xff);
+    header[9] = (char) (length >> 8);
+
+    m_file.write(header, sizeof(header));
+    m_file.write((const char *) data, length);
+    /* captures are mostly taken to analyze incidents, so don't lose data
+     * that is still buffered when the process dies */
+    m_file.flush();
+
+    if (!m_file) {
+	std::cerr << "Writing capture file failed, stopping capture" << std::endl;
+	m_failed = true;
+    }
+}
+
+BusCaptureReader::BusCaptureReader(const std::string& path) :
+    m_file(path.c_str(), std::ios::in | std::ios::binary),
+    m_valid(false)
+{
+    char header[BusCapture::HeaderSize];
+
+    if (!m_file.read(header, sizeof(header))) {
+	return;
+    }
+
+    m_valid = memcmp(header, BusCapture::Magic, sizeof(BusCapture::Magic)) == 0 &&
+	    (uint8_t) header[sizeof(BusCapture::Magic)] == BusCapture::Version;
+}
+
+bool
+BusCaptureReader::read(uint64_t& timestamp, uint8_t *buffer, size_t maxLength, size_t& length)
+{
+    uint8_t header[BusCapture::RecordHeaderSize];
+
+    if (!m_valid || !m_file.read((char *) header, sizeof(header))) {
+	return false;
+    }
+
+    timestamp = 0;
+    for (size_t i = 0; i < 8; i++) {
+	timestamp |= (uint64_t) header[i] << (8 * i);
+    }
+    length = header[8] | (header[9] << 8);
+
+    if (length > maxLength) {
+	std::cerr << "Capture record of " << length << " bytes exceeds read buffer" << std::endl;
+	return false;
+    }
+
+    return (bool) m_file.read((char *) buffer, length);
+}
@@ -0,0 +1,77 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BUSCAPTURE_H__
+#define __BUSCAPTURE_H__
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include "Noncopyable.h"
+
+/*
+ * Raw bus capture file format (all integers little endian):
+ *
+ * header: "EMSCAP" magic, 1 byte format version
+ * record: 8 byte receive timestamp (us since epoch), 2 byte length, data
+ *
+ * Each record holds the bytes delivered by one read, so replaying the
+ * records reproduces the exact read boundaries seen by the parser.
+ */
+class BusCapture
+{
+    public:
+	static const char Magic[6];
+	static const uint8_t Version = 1;
+	static const size_t HeaderSize = sizeof(Magic) + 1;
+	static const size_t RecordHeaderSize = 8 + 2;
+};
+
+class BusCaptureWriter : private boost::noncopyable
+{
+    public:
+	BusCaptureWriter(const std::string& path);
+
+	bool isOpen() const {
+	    return m_file.is_open();
+	}
+	void write(const uint8_t *data, size_t length);
+
+    private:
+	std::ofstream m_file;
+	bool m_failed;
+};
+
+class BusCaptureReader : private boost::noncopyable
+{
+    public:
+	BusCaptureReader(const std::string& path);
+
+	bool isValid() const {
+	    return m_valid;
+	}
+	/* returns false at end of file or if the record doesn't fit */
+	bool read(uint64_t& timestamp, uint8_t *buffer, size_t maxLength, size_t& length);
+
+    private:
+	std::ifstream m_file;
+	bool m_valid;
+};
+
+#endif /* __BUSCAPTURE_H__ */
@@ -0,0 +1,231 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "CacheSnapshot.h"
+
+namespace bip = boost::interprocess;
+
+const char CacheSnapshot::Magic[8] = { 'E', 'M', 'S', 'C', 'A', 'C', 'H', 'E' };
+
+CacheSnapshot::CacheSnapshot(const std::string& path, size_t slotCount) :
+    m_records(NULL),
+    m_slotCount(slotCount)
+{
+    size_t size = sizeof(Header) + slotCount * sizeof(Record);
+
+    if (!prepareFile(path, size)) {
+	std::cerr << "Could not create cache snapshot file " << path << "." << std::endl;
+	return;
+    }
+
+    try {
+	bip::file_mapping file(path.c_str(), bip::read_write);
+	bip::mapped_region region(file, bip::read_write, 0, size);
+	m_file.swap(file);
+	m_region.swap(region);
+    } catch (bip::interprocess_exception& e) {
+	std::cerr << "Could not map cache snapshot file " << path << ": " << e.what() << std::endl;
+	return;
+    }
+
+    char *base = static_cast<char *>(m_region.get_address());
+    m_records = reinterpret_cast<Record *>(base + sizeof(Header));
+}
+
+CacheSnapshot::~CacheSnapshot()
+{
+    flush();
+}
+
+bool
+CacheSnapshot::prepareFile(const std::string& path, size_t size)
+{
+    Header header;
+    std::ifstream in(path.c_str(), std::ios::binary);
+
+    if (in.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+	in.seekg(0, std::ios::end);
+	if (memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+		header.version == Version &&
+		header.typeCount == EmsValue::TypeLast &&
+		header.subTypeCount == EmsValue::SubTypeLast &&
+		header.recordSize == sizeof(Record) &&
+		(size_t) in.tellg() == size) {
+	    return true;
+	}
+    }
+    in.close();
+
+    /* missing or written by an incompatible version, start from scratch */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.typeCount = EmsValue::TypeLast;
+    header.subTypeCount = EmsValue::SubTypeLast;
+    header.recordSize = sizeof(Record);
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.seekp(size - 1);
+    out.put(0);
+
+    return (bool) out;
+}
+
+void
+CacheSnapshot::restore(const RestoreCallback& cb) const
+{
+    if (!m_records) {
+	return;
+    }
+
+    for (size_t i = 0; i < m_slotCount; i++) {
+	const Record& record = m_records[i];
+	EmsValue::Reading reading;
+
+	if (!record.used || record.type >= EmsValue::TypeLast ||
+		record.subType >= EmsValue::SubTypeLast || !decode(record, reading)) {
+	    continue;
+	}
+
+	EmsValue value((EmsValue::Type) record.type, (EmsValue::SubType) record.subType,
+		       (EmsValue::ReadingType) record.readingType, reading, record.valid != 0);
+	cb((time_t) record.timestamp, value);
+    }
+}
+
+void
+CacheSnapshot::store(size_t slot, time_t timestamp, const EmsValue& value)
+{
+    if (!m_records || slot >= m_slotCount) {
+	return;
+    }
+
+    Record& record = m_records[slot];
+
+    record.used = 0;
+    if (!encode(value, record)) {
+	return;
+    }
+    record.type = value.getType();
+    record.subType = value.getSubType();
+    record.timestamp = timestamp;
+    record.used = 1;
+}
+
+void
+CacheSnapshot::flush()
+{
+    if (m_records) {
+	m_region.flush();
+    }
+}
+
+bool
+CacheSnapshot::encode(const EmsValue& value, Record& record)
+{
+    record.readingType = value.getReadingType();
+    record.valid = value.isValid() ? 1 : 0;
+
+    switch (value.getReadingType()) {
+	case EmsValue::Numeric:
+	    return setData(record, &value.getValue<float>(), sizeof(float));
+	case EmsValue::Integer:
+	    return setData(record, &value.getValue<unsigned int>(), sizeof(unsigned int));
+	case EmsValue::Boolean:
+	    return setData(record, &value.getValue<bool>(), sizeof(bool));
+	case EmsValue::Enumeration:
+	    return setData(record, &value.getValue<uint8_t>(), sizeof(uint8_t));
+	case EmsValue::Kennlinie: {
+	    const std::vector<uint8_t>& points = value.getValue<std::vector<uint8_t> >();
+	    return setData(record, points.data(), points.size());
+	}
+	case EmsValue::Error:
+	    return setData(record, &value.getValue<EmsValue::ErrorEntry>(),
+			   sizeof(EmsValue::ErrorEntry));
+	case EmsValue::Date:
+	    return setData(record, &value.getValue<EmsProto::DateRecord>(),
+			   sizeof(EmsProto::DateRecord));
+	case EmsValue::SystemTime:
+	    return setData(record, &value.getValue<EmsProto::SystemTimeRecord>(),
+			   sizeof(EmsProto::SystemTimeRecord));
+	case EmsValue::Formatted: {
+	    const std::string& text = value.getValue<std::string>();
+	    return setData(record, text.data(), text.size());
+	}
+    }
+
+    return false;
+}
+
+bool
+CacheSnapshot::decode(const Record& record, EmsValue::Reading& reading)
+{
+    switch (record.readingType) {
+	case EmsValue::Numeric:
+	    return getData<float>(record, reading);
+	case EmsValue::Integer:
+	    return getData<unsigned int>(record, reading);
+	case EmsValue::Boolean:
+	    return getData<bool>(record, reading);
+	case EmsValue::Enumeration:
+	    return getData<uint8_t>(record, reading);
+	case EmsValue::Kennlinie:
+	    reading = std::vector<uint8_t>(record.data, record.data + record.length);
+	    return true;
+	case EmsValue::Error:
+	    return getData<EmsValue::ErrorEntry>(record, reading);
+	case EmsValue::Date:
+	    return getData<EmsProto::DateRecord>(record, reading);
+	case EmsValue::SystemTime:
+	    return getData<EmsProto::SystemTimeRecord>(record, reading);
+	case EmsValue::Formatted:
+	    reading = std::string((const char *) record.data, record.length);
+	    return true;
+    }
+
+    return false;
+}
+
+bool
+CacheSnapshot::setData(Record& record, const void *data, size_t length)
+{
+    if (length > sizeof(record.data)) {
+	return false;
+    }
+    memcpy(record.data, data, length);
+    record.length = length;
+    return true;
+}
+
+template<typename T> bool
+CacheSnapshot::getData(const Record& record, EmsValue::Reading& reading)
+{
+    T value;
+
+    if (record.length != sizeof(T)) {
+	return false;
+    }
+    memcpy(&value, record.data, sizeof(T));
+    reading = value;
+    return true;
+}
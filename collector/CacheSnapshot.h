@@ -0,0 +1,92 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHESNAPSHOT_H__
+#define __CACHESNAPSHOT_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <functional>
+#include <string>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "EmsMessage.h"
+#include "Noncopyable.h"
+
+/*
+ * Memory mapped mirror of the value cache. The file consists of a header
+ * followed by one fixed size record per cache slot, so updating a value
+ * is a plain memory copy and the kernel takes care of writing it back.
+ * The file is only valid for the host it was written on.
+ */
+class CacheSnapshot : private boost::noncopyable
+{
+    public:
+	typedef std::function<void (time_t timestamp, const EmsValue& value)> RestoreCallback;
+
+	CacheSnapshot(const std::string& path, size_t slotCount);
+	~CacheSnapshot();
+
+	bool isValid() const {
+	    return m_records != NULL;
+	}
+	void restore(const RestoreCallback& cb) const;
+	void store(size_t slot, time_t timestamp, const EmsValue& value);
+	void flush();
+
+	/* also used by the value cache for its in-memory copy */
+	struct Record {
+	    /* cleared while the record is written */
+	    uint8_t used;
+	    uint8_t readingType;
+	    uint8_t valid;
+	    uint8_t length;
+	    uint16_t type;
+	    uint16_t subType;
+	    int64_t timestamp;
+	    uint8_t data[52];
+	};
+
+	static bool encode(const EmsValue& value, Record& record);
+	static bool decode(const Record& record, EmsValue::Reading& reading);
+
+    private:
+	struct Header {
+	    char magic[8];
+	    uint32_t version;
+	    uint32_t typeCount;
+	    uint32_t subTypeCount;
+	    uint32_t recordSize;
+	};
+
+	static const char Magic[8];
+	static const uint32_t Version = 1;
+
+	bool prepareFile(const std::string& path, size_t size);
+	static bool setData(Record& record, const void *data, size_t length);
+	template<typename T> static bool getData(const Record& record, EmsValue::Reading& reading);
+
+    private:
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+	Record *m_records;
+	size_t m_slotCount;
+};
+
+#endif /* __CACHESNAPSHOT_H__ */
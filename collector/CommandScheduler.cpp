@@ -17,111 +17,359 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <boost/bind/bind.hpp>
 #include "CommandScheduler.h"
 #include "Options.h"
 
+EmsCommandSender::Destination&
+EmsCommandSender::destination(uint8_t address)
+{
+    std::unique_ptr<Destination>& dest = m_destinations[address & 0x7f];
+    if (!dest) {
+	dest.reset(new Destination(m_ios));
+    }
+    return *dest;
+}
+
 void
 EmsCommandSender::handlePcMessage(const EmsMessage& message)
-
 {
-    m_lastCommTimes[message.getSource()] = boost::posix_time::microsec_clock::universal_time();
-    m_responseTimeout.cancel();
-    if (m_currentClient) {
-	m_currentClient->onIncomingMessage(message);
+    boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+    Destination& dest = destination(message.getSource());
+
+    dest.lastCommTime = now;
+    if (!dest.currentClient) {
+	return;
+    }
+
+    if (!dest.sampleStart.is_not_a_date_time()) {
+	addRttSample(dest, (now - dest.sampleStart).total_milliseconds());
+	dest.sampleStart = boost::posix_time::ptime();
     }
-    continueWithNextRequest();
+    dest.backoff = 0;
+    handleResponse(dest, message);
 }
 
 void
-EmsCommandSender::sendMessage(ClientPtr& client, MessagePtr& message)
+EmsCommandSender::addRttSample(Destination& dest, long rtt)
+{
+    if (dest.srtt == 0) {
+	dest.srtt = std::max(rtt, 1L);
+	dest.rttvar = rtt / 2.0;
+    } else {
+	dest.rttvar = 0.75 * dest.rttvar + 0.25 * std::abs(dest.srtt - rtt);
+	dest.srtt = 0.875 * dest.srtt + 0.125 * rtt;
+    }
+
+    if (Options::statsDebug()) {
+	Options::statsDebug() << "CMD: round trip " << std::dec << rtt << " ms, smoothed "
+			      << dest.srtt << " ms, variance " << dest.rttvar << " ms" << std::endl;
+    }
+}
+
+long
+EmsCommandSender::responseTimeout(const Destination& dest)
 {
-    bool wasIdle = !m_currentClient;
-    m_pending.push_back(std::make_pair(client, message));
-    if (wasIdle) {
-	continueWithNextRequest();
+    long timeout = RequestTimeout;
+    if (dest.srtt != 0) {
+	timeout = std::max((long) (dest.srtt + 4 * dest.rttvar), MinRequestTimeout);
     }
+    return std::min(timeout << dest.backoff, MaxRequestTimeout);
+}
+
+long
+EmsCommandSender::writeAnswerDelay(const Destination& dest)
+{
+    /* writes aren't answered, wait about as long as a read would take */
+    if (dest.srtt == 0) {
+	return WriteAnswerDelay;
+    }
+    return std::min(std::max((long) (dest.srtt + 2 * dest.rttvar), MinWriteAnswerDelay),
+		    WriteAnswerDelay);
+}
+
+long
+EmsCommandSender::requestSpacing(const Destination& dest)
+{
+    long spacing = MinDistanceBetweenRequests;
+    if (dest.srtt != 0) {
+	spacing = std::max((long) dest.srtt, MinRequestSpacing);
+    }
+    return std::min(spacing << dest.backoff, MaxRequestSpacing);
+}
+
+bool
+EmsCommandSender::hasPendingRequests(const ClientPtr& except) const
+{
+    for (auto& item : m_destinations) {
+	const Destination& dest = *item.second;
+	if (dest.currentClient && dest.currentClient != except) {
+	    return true;
+	}
+	for (auto& waiter : dest.currentWaiters) {
+	    if (waiter != except) {
+		return true;
+	    }
+	}
+	for (auto& queues : dest.queues) {
+	    for (auto& queue : queues) {
+		if (queue.client != except) {
+		    return true;
+		}
+		for (auto& request : queue.requests) {
+		    for (auto& waiter : request.waiters) {
+			if (waiter != except) {
+			    return true;
+			}
+		    }
+		}
+	    }
+	}
+    }
+    return false;
 }
 
 void
-EmsCommandSender::scheduleResponseTimeout(bool fakeAnswer)
+EmsCommandSender::handleResponse(Destination& dest, const EmsMessage& message)
 {
-    if (fakeAnswer){
-        m_responseTimeout.expires_from_now(boost::posix_time::milliseconds(200));
-    
-        m_responseTimeout.async_wait([this] (const boost::system::error_code& error) {
-            if (error != boost::asio::error::operation_aborted) {
-                if (m_currentClient) {
-
-                    std::vector<uint8_t> fakeData(0x00, 0x01);
-                    EmsMessage fake(0x0b, 0xff, 0x01, fakeData, false);
-                    handlePcMessage(fake);	        
-                    
-                }
-                continueWithNextRequest();
-            }
-        });
-        
-    } else {
+    std::vector<ClientPtr> waiters;
 
-        m_responseTimeout.expires_from_now(boost::posix_time::milliseconds(RequestTimeout));
-    
-        m_responseTimeout.async_wait([this] (const boost::system::error_code& error) {
-            if (error != boost::asio::error::operation_aborted) {
-                if (m_currentClient) {
+    /* the callbacks may queue follow-up requests */
+    waiters.swap(dest.currentWaiters);
+    dest.responseTimeout.cancel();
+    dest.currentClient->onIncomingMessage(message);
+    for (auto& waiter : waiters) {
+	waiter->onIncomingMessage(message);
+    }
+    continueWithNextRequest(dest);
+}
+
+bool
+EmsCommandSender::isSameRead(const EmsMessage& first, const EmsMessage& second)
+{
+    const EmsMessage::Payload& firstData = first.getData();
+    const EmsMessage::Payload& secondData = second.getData();
+
+    return first.getDestination() == second.getDestination() &&
+	    first.getType() == second.getType() &&
+	    first.getOffset() == second.getOffset() &&
+	    firstData.size() == secondData.size() &&
+	    std::equal(firstData.begin(), firstData.end(), secondData.begin());
+}
+
+bool
+EmsCommandSender::coalesceRead(Destination& dest, const ClientPtr& client,
+			       const MessagePtr& message)
+{
+    std::vector<ClientPtr> *waiters = NULL;
 
-                    m_currentClient->onTimeout();  
+    if (dest.currentMessage && dest.currentClient != client &&
+	    isSameRead(*dest.currentMessage, *message)) {
+	waiters = &dest.currentWaiters;
+    }
+    for (auto& queues : dest.queues) {
+	for (auto& queue : queues) {
+	    for (auto iter = queue.requests.begin();
+		    !waiters && queue.client != client && iter != queue.requests.end(); ++iter) {
+		if (isSameRead(*iter->message, *message)) {
+		    waiters = &iter->waiters;
+		}
+	    }
+	}
+    }
 
-                }
-                continueWithNextRequest();
-            }
-        });
-        
+    if (!waiters) {
+	return false;
+    }
+    if (std::find(waiters->begin(), waiters->end(), client) == waiters->end()) {
+	waiters->push_back(client);
+    }
+    if (Options::statsDebug()) {
+	Options::statsDebug() << "CMD: read coalesced with a pending identical one" << std::endl;
     }
+    return true;
 }
 
 void
-EmsCommandSender::sendMessage(const MessagePtr& message)
+EmsCommandSender::sendMessage(ClientPtr& client, MessagePtr& message)
 {
-    auto timeIter = m_lastCommTimes.find(message->getDestination());
-    bool scheduled = false;
+    Destination& dest = destination(message->getDestination());
+    bool isRead = (message->getDestination() & 0x80) != 0;
 
-    if (timeIter != m_lastCommTimes.end()) {
-	boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
-	boost::posix_time::time_duration diff = now - timeIter->second;
+    /* several clients reading the same data share one bus transaction */
+    if (isRead && coalesceRead(dest, client, message)) {
+	return;
+    }
+    if (!isRead) {
+	m_responseCache.invalidate(message->getDestination(), message->getType(),
+				   message->getOffset(), message->getData().size());
+    }
 
-	if (diff.total_milliseconds() <= MinDistanceBetweenRequests) {
-	    m_sendTimer.expires_at(timeIter->second + boost::posix_time::milliseconds(MinDistanceBetweenRequests));
-	    m_sendTimer.async_wait(boost::bind(&EmsCommandSender::doSendMessage, this, *message));
-	    scheduled = true;
+    /* a client that changed its priority keeps its queued requests in order */
+    std::list<ClientQueue> *queues = NULL;
+    std::list<ClientQueue>::iterator iter;
+    for (auto& candidate : dest.queues) {
+	auto found = std::find_if(candidate.begin(), candidate.end(),
+				  [&client] (const ClientQueue& queue) {
+	    return queue.client == client;
+	});
+	if (found != candidate.end()) {
+	    queues = &candidate;
+	    iter = found;
 	}
     }
-    if (!scheduled) {
-	doSendMessage(*message);
+
+    size_t& queued = m_queuedPerClient[client];
+    if (queued >= MaxQueuedPerClient) {
+	/* treat like a request the device didn't answer, the client
+	 * decides whether to retry or to give up */
+	if (Options::statsDebug()) {
+	    Options::statsDebug() << "CMD: client exceeds request queue limit" << std::endl;
+	}
+	m_ios.post([client] () {
+	    client->onTimeout();
+	});
+	return;
+    }
+    if (!queues) {
+	queues = &dest.queues[client->priority()];
+	iter = queues->insert(queues->end(), ClientQueue { client, std::list<Request>() });
+    }
+    iter->requests.push_back(Request { message, std::vector<ClientPtr>() });
+    queued++;
+
+    if (!dest.currentClient) {
+	continueWithNextRequest(dest);
     }
 }
 
 void
-EmsCommandSender::doSendMessage(const EmsMessage& message)
+EmsCommandSender::scheduleResponseTimeout(Destination& dest, bool fakeAnswer)
 {
-    bool fakeAnswer = ((message.getDestination() & 0x80) == 0);
+    if (fakeAnswer) {
+	dest.responseTimeout.expires_from_now(boost::posix_time::milliseconds(writeAnswerDelay(dest)));
+	dest.responseTimeout.async_wait([this, &dest] (const boost::system::error_code& error) {
+	    if (error != boost::asio::error::operation_aborted && dest.currentClient) {
+		std::vector<uint8_t> fakeData(0x00, 0x01);
+		EmsMessage fake(0x0b, 0xff, 0x01, fakeData, false);
+		handleResponse(dest, fake);
+	    }
+	});
+    } else {
+	dest.responseTimeout.expires_from_now(boost::posix_time::milliseconds(responseTimeout(dest)));
+	dest.responseTimeout.async_wait([this, &dest] (const boost::system::error_code& error) {
+	    if (error != boost::asio::error::operation_aborted) {
+		dest.backoff = std::min(dest.backoff + 1, MaxBackoff);
+		dest.sampleStart = boost::posix_time::ptime();
+		dest.timedOut = true;
+		if (dest.currentClient) {
+		    std::vector<ClientPtr> waiters;
+		    waiters.swap(dest.currentWaiters);
+		    dest.currentClient->onTimeout();
+		    for (auto& waiter : waiters) {
+			waiter->onTimeout();
+		    }
+		}
+		continueWithNextRequest(dest);
+	    }
+	});
+    }
+}
+
+void
+EmsCommandSender::sendMessage(Destination& dest, const MessagePtr& message)
+{
+    boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+    boost::posix_time::ptime earliest = now;
+
+    if (!dest.lastCommTime.is_not_a_date_time()) {
+	earliest = std::max(earliest,
+		dest.lastCommTime + boost::posix_time::milliseconds(requestSpacing(dest)));
+    }
+    if (!m_lastSendTime.is_not_a_date_time()) {
+	earliest = std::max(earliest,
+		m_lastSendTime + boost::posix_time::milliseconds(MinDistanceBetweenSends));
+    }
 
-    sendMessageImpl(message);
-    scheduleResponseTimeout(fakeAnswer);
-    
-    m_lastCommTimes[message.getDestination()] = boost::posix_time::microsec_clock::universal_time();
+    if (earliest <= now) {
+	doSendMessage(dest, message);
+	return;
+    }
+
+    dest.sendTimer.expires_at(earliest);
+    dest.sendTimer.async_wait([this, &dest, message] (const boost::system::error_code& error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    /* another device may have taken the bus in the meantime */
+	    sendMessage(dest, message);
+	}
+    });
 }
 
 void
-EmsCommandSender::continueWithNextRequest()
+EmsCommandSender::doSendMessage(Destination& dest, const MessagePtr& message)
 {
-    if (m_pending.empty()) {
-	m_currentClient.reset();
+    bool fakeAnswer = ((message->getDestination() & 0x80) == 0);
+    boost::posix_time::ptime now(boost::posix_time::microsec_clock::universal_time());
+
+    sendMessageImpl(*message);
+
+    /* after a timeout, a late answer to the previous request could be taken
+     * for the answer to this one, so don't time it (Karn's algorithm) */
+    if (!fakeAnswer && !dest.timedOut) {
+	dest.sampleStart = now;
+    } else {
+	dest.sampleStart = boost::posix_time::ptime();
+    }
+    dest.timedOut = false;
+    scheduleResponseTimeout(dest, fakeAnswer);
+
+    dest.lastCommTime = now;
+    m_lastSendTime = now;
+}
+
+void
+EmsCommandSender::continueWithNextRequest(Destination& dest)
+{
+    std::list<ClientQueue> *queues;
+
+    std::list<ClientQueue>& interactive = dest.queues[EmsCommandClient::Interactive];
+    std::list<ClientQueue>& background = dest.queues[EmsCommandClient::Background];
+
+    /* weighted round robin between the client priorities, so background
+     * clients are delayed but not starved by interactive ones */
+    if (interactive.empty() && background.empty()) {
+	dest.currentClient.reset();
+	dest.currentMessage.reset();
 	return;
+    } else if (background.empty()) {
+	queues = &interactive;
+    } else if (interactive.empty() || dest.interactiveCredits == 0) {
+	queues = &background;
+	dest.interactiveCredits = InteractiveWeight;
+    } else {
+	queues = &interactive;
+	dest.interactiveCredits--;
+    }
+
+    /* round robin between the clients of a priority */
+    ClientQueue& queue = queues->front();
+    MessagePtr message = queue.requests.front().message;
+
+    dest.currentClient = queue.client;
+    dest.currentMessage = message;
+    dest.currentWaiters.swap(queue.requests.front().waiters);
+    queue.requests.pop_front();
+    auto queued = m_queuedPerClient.find(queue.client);
+    if (--queued->second == 0) {
+	m_queuedPerClient.erase(queued);
+    }
+    if (queue.requests.empty()) {
+	queues->pop_front();
+    } else {
+	queues->splice(queues->end(), *queues, queues->begin());
     }
-    auto& item = m_pending.front();
-    m_currentClient = item.first;
 
-    sendMessage(item.second);
-    m_pending.pop_front();
+    sendMessage(dest, message);
 }
@@ -22,15 +22,40 @@
 
 #include <map>
 #include <list>
+#include <memory>
+#include <vector>
 #include <boost/asio.hpp>
 #include "EmsMessage.h"
 #include "Noncopyable.h"
+#include "ResponseCache.h"
 
 class EmsCommandClient
 {
     public:
+	/* interactive clients act on behalf of a user, background clients
+	 * (polling, bulk dumps) are delayed but not starved by them */
+	typedef enum {
+	    Interactive,
+	    Background,
+	    PriorityCount
+	} Priority;
+
+	EmsCommandClient(Priority priority = Interactive) :
+	    m_priority(priority)
+	{}
+
 	virtual void onIncomingMessage(const EmsMessage& message) = 0;
 	virtual void onTimeout() = 0;
+
+	Priority priority() const {
+	    return m_priority;
+	}
+	void setPriority(Priority priority) {
+	    m_priority = priority;
+	}
+
+    private:
+	Priority m_priority;
 };
 
 class EmsCommandSender : public boost::noncopyable
@@ -40,35 +65,111 @@ class EmsCommandSender : public boost::noncopyable
 	typedef boost::shared_ptr<EmsCommandClient> ClientPtr;
 
 	EmsCommandSender(boost::asio::io_service& ios) :
-	    m_responseTimeout(ios),
-	    m_sendTimer(ios)
+	    m_ios(ios)
         {}
 	~EmsCommandSender() {
-	    m_responseTimeout.cancel();
-	    m_sendTimer.cancel();
+	    for (auto& item : m_destinations) {
+		item.second->responseTimeout.cancel();
+		item.second->sendTimer.cancel();
+	    }
 	}
 
 	void handlePcMessage(const EmsMessage& message);
 	void sendMessage(ClientPtr& client, MessagePtr& message);
+	/* whether clients other than the given one have requests in flight or queued */
+	bool hasPendingRequests(const ClientPtr& except) const;
+	ResponseCache& responseCache() {
+	    return m_responseCache;
+	}
 
     protected:
 	virtual void sendMessageImpl(const EmsMessage& message) = 0;
 
     private:
-	void continueWithNextRequest();
-	void scheduleResponseTimeout(bool fakeAnswer);
-	void sendMessage(const MessagePtr& message);
-	void doSendMessage(const EmsMessage& message);
+	struct Request {
+	    MessagePtr message;
+	    /* clients that asked for the same read, answered along with the owner */
+	    std::vector<ClientPtr> waiters;
+	};
+
+	struct ClientQueue {
+	    ClientPtr client;
+	    std::list<Request> requests;
+	};
+
+	/* requests are queued per device, so a slow device only
+	 * delays requests to itself */
+	struct Destination {
+	    Destination(boost::asio::io_service& ios) :
+		interactiveCredits(InteractiveWeight),
+		srtt(0),
+		rttvar(0),
+		backoff(0),
+		timedOut(false),
+		responseTimeout(ios),
+		sendTimer(ios)
+	    {}
+
+	    ClientPtr currentClient;
+	    MessagePtr currentMessage;
+	    std::vector<ClientPtr> currentWaiters;
+	    /* per client priority, clients with pending requests in round robin order */
+	    std::list<ClientQueue> queues[EmsCommandClient::PriorityCount];
+	    /* interactive requests sent before background ones get a turn */
+	    unsigned int interactiveCredits;
+	    /* last frame sent to or received from the device */
+	    boost::posix_time::ptime lastCommTime;
+	    /* round trip estimation as done by TCP (RFC 6298), in ms;
+	     * srtt is 0 as long as there's no sample */
+	    double srtt;
+	    double rttvar;
+	    /* number of timeouts in a row, each doubles timeout and spacing */
+	    unsigned int backoff;
+	    /* send time of the request in flight, not a date time if
+	     * it isn't timed */
+	    boost::posix_time::ptime sampleStart;
+	    bool timedOut;
+	    boost::asio::deadline_timer responseTimeout;
+	    boost::asio::deadline_timer sendTimer;
+	};
+
+	static bool isSameRead(const EmsMessage& first, const EmsMessage& second);
+	Destination& destination(uint8_t address);
+	bool coalesceRead(Destination& dest, const ClientPtr& client, const MessagePtr& message);
+	static void addRttSample(Destination& dest, long rtt);
+	static long responseTimeout(const Destination& dest);
+	static long writeAnswerDelay(const Destination& dest);
+	static long requestSpacing(const Destination& dest);
+	void handleResponse(Destination& dest, const EmsMessage& message);
+	void continueWithNextRequest(Destination& dest);
+	void scheduleResponseTimeout(Destination& dest, bool fakeAnswer);
+	void sendMessage(Destination& dest, const MessagePtr& message);
+	void doSendMessage(Destination& dest, const MessagePtr& message);
 
     private:
-	static const unsigned int RequestTimeout = 1000; /* ms */
+	/* used until the first round trip of a device was measured */
+	static const long RequestTimeout = 1000; /* ms */
+	static const long WriteAnswerDelay = 200; /* ms */
 	static const long MinDistanceBetweenRequests = 100; /* ms */
+	/* bounds of the values derived from the round trip time */
+	static const long MinRequestTimeout = 200; /* ms */
+	static const long MaxRequestTimeout = 5000; /* ms */
+	static const long MinWriteAnswerDelay = 100; /* ms */
+	static const long MinRequestSpacing = 30; /* ms */
+	static const long MaxRequestSpacing = 1000; /* ms */
+	static const unsigned int MaxBackoff = 3;
+	/* bus occupancy: minimum distance between any two sent frames */
+	static const long MinDistanceBetweenSends = 50; /* ms */
+	static const unsigned int InteractiveWeight = 4;
+	/* queued requests of a client over all destinations */
+	static const size_t MaxQueuedPerClient = 8;
 
-	ClientPtr m_currentClient;
-	std::list<std::pair<ClientPtr, MessagePtr> > m_pending;
-	boost::asio::deadline_timer m_responseTimeout;
-	boost::asio::deadline_timer m_sendTimer;
-	std::map<uint8_t, boost::posix_time::ptime> m_lastCommTimes;
+	boost::asio::io_service& m_ios;
+	/* indexed by device address without the read bit */
+	std::map<uint8_t, std::unique_ptr<Destination> > m_destinations;
+	std::map<ClientPtr, size_t> m_queuedPerClient;
+	boost::posix_time::ptime m_lastSendTime;
+	ResponseCache m_responseCache;
 };
 
 #endif /* __COMMANDSCHEDULER_H__ */
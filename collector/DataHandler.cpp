@@ -17,15 +17,28 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <boost/make_shared.hpp>
 #include "DataHandler.h"
+#include "Options.h"
 #include "ValueApi.h"
+#include "ValueCache.h"
 
-DataHandler::DataHandler(boost::asio::io_service& ios,
+const char DataProtocol::Magic[6] = { 'E', 'M', 'S', 'D', 'A', 'T' };
+
+DataHandler::DataHandler(boost::asio::io_service& ios, ValueCache *cache,
 			 boost::asio::ip::tcp::endpoint& endpoint) :
     m_ios(ios),
-    m_acceptor(ios, endpoint)
+    m_acceptor(ios, endpoint),
+    m_cache(cache),
+    m_namedTypes(EmsValue::TypeLast),
+    m_sequence(0)
 {
+    for (size_t type = 0; type < EmsValue::TypeLast; type++) {
+	m_namedTypes[type] = !ValueApi::getTypeName((EmsValue::Type) type).empty();
+    }
     startAccepting();
 }
 
@@ -56,6 +69,7 @@ void
 DataHandler::startConnection(DataConnection::Ptr connection)
 {
     m_connections.insert(connection);
+    connection->start();
 }
 
 void
@@ -65,11 +79,180 @@ DataHandler::stopConnection(DataConnection::Ptr connection)
     connection->close();
 }
 
+static void
+appendLe(std::string& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+	out.push_back((char) (value >> (8 * i)));
+    }
+}
+
+static uint64_t
+monotonicTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void
 DataHandler::handleValue(const EmsValue& value)
 {
-    std::for_each(m_connections.begin(), m_connections.end(),
-		  boost::bind(&DataConnection::handleValue, boost::placeholders::_1, value));
+    /* values without name are never sent, so they must not take a
+     * sequence number, clients would take the gap for a lost value */
+    if (!m_namedTypes[value.getType()]) {
+	return;
+    }
+
+    /* counted even without clients, a snapshot refers to the cache contents */
+    m_sequence++;
+
+    if (m_connections.empty()) {
+	return;
+    }
+
+    enum { PlainText, SequencedText, Binary, FormatCount };
+    uint64_t timestamp = monotonicTimestamp();
+    size_t id = DataProtocol::valueId(value.getType(), value.getSubType());
+    DataConnection::Buffer buffers[FormatCount];
+    bool formatted[FormatCount] = { false, false, false };
+
+    /* advance before sending, a slow client may be disconnected by send() */
+    for (auto iter = m_connections.begin(); iter != m_connections.end(); ) {
+	DataConnection::Ptr connection = *iter++;
+
+	if (!connection->isSubscribed(id)) {
+	    continue;
+	}
+
+	int format = connection->mode() == DataConnection::BinaryMode ? Binary
+		: connection->isSequenced() ? SequencedText : PlainText;
+
+	/* format lazily, each representation only once per value */
+	if (!formatted[format]) {
+	    std::string out;
+	    bool ok;
+
+	    if (format == Binary) {
+		ok = appendBinary(out, value, m_sequence, timestamp,
+				  value.isValid() ? DataProtocol::ValidFlag : 0);
+	    } else {
+		ok = appendText(out, value, format == SequencedText ? &m_sequence : NULL);
+	    }
+	    if (ok) {
+		buffers[format] = boost::make_shared<const std::string>(out);
+	    }
+	    formatted[format] = true;
+	}
+
+	if (buffers[format]) {
+	    connection->send(buffers[format]);
+	}
+    }
+}
+
+void
+DataHandler::sendSnapshot(DataConnection::Ptr connection)
+{
+    bool binary = connection->mode() == DataConnection::BinaryMode;
+    uint64_t now = monotonicTimestamp();
+    time_t wallNow = time(NULL);
+    std::ostringstream header;
+    std::string out;
+
+    if (!binary) {
+	header << "snapshot begin " << m_sequence << "\n";
+	out = header.str();
+    }
+
+    /* everything runs on the io thread, so the cache holds exactly
+     * the values up to m_sequence */
+    for (size_t type = 0; m_cache && type < EmsValue::TypeLast; type++) {
+	for (size_t subtype = 0; m_namedTypes[type] && subtype < EmsValue::SubTypeLast; subtype++) {
+	    if (!connection->isSubscribed(DataProtocol::valueId((EmsValue::Type) type,
+								 (EmsValue::SubType) subtype))) {
+		continue;
+	    }
+
+	    ValueCache::EntryPtr entry = m_cache->getEntry((EmsValue::Type) type,
+							   (EmsValue::SubType) subtype);
+	    if (!entry) {
+		continue;
+	    }
+
+	    if (binary) {
+		uint64_t age = wallNow > entry->timestamp ? wallNow - entry->timestamp : 0;
+		uint8_t flags = DataProtocol::SnapshotFlag;
+		if (entry->value.isValid()) {
+		    flags |= DataProtocol::ValidFlag;
+		}
+		appendBinary(out, entry->value, m_sequence,
+			     now > age * 1000000 ? now - age * 1000000 : 0, flags);
+	    } else {
+		appendText(out, entry->value, &m_sequence);
+	    }
+	}
+    }
+
+    if (binary) {
+	appendLe(out, DataProtocol::SnapshotEndId, 2);
+	out.push_back(0);
+	out.push_back(DataProtocol::SnapshotFlag);
+	appendLe(out, m_sequence, 8);
+	appendLe(out, now, 8);
+	appendLe(out, 0, 2);
+    } else {
+	std::ostringstream footer;
+	footer << "snapshot end " << m_sequence << "\n";
+	out += footer.str();
+    }
+
+    /* sent as one buffer, so the snapshot is either queued completely or not at all */
+    connection->send(boost::make_shared<const std::string>(out), true);
+}
+
+bool
+DataHandler::appendText(std::string& out, const EmsValue& value, const uint64_t *sequence)
+{
+    std::ostringstream stream;
+    std::string type = ValueApi::getTypeName(value.getType());
+    std::string subtype = ValueApi::getSubTypeName(value.getSubType());
+
+    if (type.empty()) {
+	return false;
+    }
+
+    if (sequence) {
+	stream << *sequence << " ";
+    }
+    if (!subtype.empty()) {
+	stream << subtype << " ";
+    }
+    stream << type << " " << ValueApi::formatValue(value) << "\n";
+
+    out += stream.str();
+    return true;
+}
+
+bool
+DataHandler::appendBinary(std::string& out, const EmsValue& value,
+			  uint64_t sequence, uint64_t timestamp, uint8_t flags)
+{
+    std::string payload = ValueApi::formatRawValue(value);
+
+    if (payload.size() > 0xffff) {
+	return false;
+    }
+
+    out.reserve(out.size() + DataProtocol::RecordHeaderSize + payload.size());
+    appendLe(out, DataProtocol::valueId(value.getType(), value.getSubType()), 2);
+    out.push_back((char) value.getReadingType());
+    out.push_back((char) flags);
+    appendLe(out, sequence, 8);
+    appendLe(out, timestamp, 8);
+    appendLe(out, payload.size(), 2);
+    out += payload;
+
+    return true;
 }
 
 void
@@ -84,7 +267,11 @@ DataHandler::startAccepting()
 
 DataConnection::DataConnection(boost::asio::io_service& ios, DataHandler& handler) :
     m_socket(ios),
-    m_handler(handler)
+    m_handler(handler),
+    m_mode(TextMode),
+    m_sequenced(false),
+    m_subscription(DataProtocol::ValueIdCount, true),
+    m_dropping(false)
 {
 }
 
@@ -93,28 +280,179 @@ DataConnection::~DataConnection()
 }
 
 void
-DataConnection::handleWrite(const boost::system::error_code& error)
+DataConnection::start()
 {
-    if (error && error != boost::asio::error::operation_aborted) {
-	m_handler.stopConnection(shared_from_this());
-    }
+    startRead();
 }
 
 void
-DataConnection::handleValue(const EmsValue& value)
+DataConnection::handleRequest(const boost::system::error_code& error)
 {
-    std::ostringstream stream;
-    std::string type = ValueApi::getTypeName(value.getType());
-    std::string subtype = ValueApi::getSubTypeName(value.getSubType());
+    if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    m_handler.stopConnection(shared_from_this());
+	}
+	return;
+    }
 
-    if (type.empty()) {
+    std::istream requestStream(&m_request);
+    std::string line;
+
+    std::getline(requestStream, line);
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+	line.erase(line.size() - 1);
+    }
+
+    std::istringstream lineStream(line);
+    std::vector<std::string> tokens;
+    std::string token;
+
+    while (lineStream >> token) {
+	tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+	startRead();
 	return;
     }
 
-    if (!subtype.empty()) {
-	stream << subtype << " ";
+    if (tokens[0] == "subscribe" || tokens[0] == "unsubscribe") {
+	std::vector<std::string> selector(tokens.begin() + 1, tokens.end());
+	updateSubscription(selector, tokens[0] == "subscribe");
+    } else if (tokens[0] == "binary" && tokens.size() == 1 && m_mode == TextMode) {
+	std::string header(DataProtocol::Magic, sizeof(DataProtocol::Magic));
+	header.push_back(DataProtocol::Version);
+
+	/* text lines not yet on the wire are of no use to a binary client;
+	 * as this may include a text snapshot, allow requesting a new one.
+	 * Only the lines of the write in progress (always complete ones)
+	 * precede the header, which is queued before any binary record. */
+	m_queue.clear();
+	m_dropping = false;
+	m_mode = BinaryMode;
+	m_sequenced = false;
+	send(boost::make_shared<const std::string>(header), true);
+    } else if (tokens[0] == "snapshot" && tokens.size() == 1 && !m_sequenced) {
+	m_sequenced = true;
+	m_handler.sendSnapshot(shared_from_this());
+    }
+
+    startRead();
+}
+
+static bool
+globMatches(const char *pattern, const char *text)
+{
+    for (; *pattern; pattern++, text++) {
+	if (*pattern == '*') {
+	    for (const char *rest = text; ; rest++) {
+		if (globMatches(pattern + 1, rest)) {
+		    return true;
+		}
+		if (!*rest) {
+		    return false;
+		}
+	    }
+	}
+	if (!*text || (*pattern != '?' && *pattern != *text)) {
+	    return false;
+	}
+    }
+    return !*text;
+}
+
+void
+DataConnection::updateSubscription(const std::vector<std::string>& selector, bool subscribe)
+{
+    /* a single token containing a slash is a subtype/type glob */
+    bool isGlob = selector.size() == 1 && selector[0].find('/') != std::string::npos;
+
+    for (size_t type = 0; type < EmsValue::TypeLast; type++) {
+	std::string typeName = ValueApi::getTypeName((EmsValue::Type) type);
+	if (typeName.empty()) {
+	    continue;
+	}
+	for (size_t subtype = 0; subtype < EmsValue::SubTypeLast; subtype++) {
+	    std::string subtypeName = ValueApi::getSubTypeName((EmsValue::SubType) subtype);
+	    bool matches;
+
+	    if (isGlob) {
+		std::string name = (subtypeName.empty() ? "none" : subtypeName) + "/" + typeName;
+		matches = globMatches(selector[0].c_str(), name.c_str());
+	    } else {
+		matches = ValueCache::matchesSelector(selector, typeName, subtypeName);
+	    }
+	    if (matches) {
+		m_subscription[DataProtocol::valueId((EmsValue::Type) type,
+						     (EmsValue::SubType) subtype)] = subscribe;
+	    }
+	}
+    }
+}
+
+void
+DataConnection::send(const Buffer& buffer, bool control)
+{
+    if (!m_queue.empty() && m_queue.size() >= Options::dataQueueSize()) {
+	if (Options::slowDataClientPolicy() == Options::DisconnectSlowClient) {
+	    if (Options::statsDebug()) {
+		Options::statsDebug() << "DATA: disconnecting slow client" << std::endl;
+	    }
+	    m_handler.stopConnection(shared_from_this());
+	    return;
+	}
+	if (!m_dropping && Options::statsDebug()) {
+	    Options::statsDebug() << "DATA: client too slow, dropping oldest values" << std::endl;
+	}
+	m_dropping = true;
+
+	/* drop the oldest live value; control buffers are few, so the
+	 * queue only exceeds its limit by them if nothing else is left */
+	auto iter = std::find_if(m_queue.begin(), m_queue.end(),
+				 [] (const QueuedBuffer& queued) {
+	    return !queued.control;
+	});
+	if (iter != m_queue.end()) {
+	    m_queue.erase(iter);
+	}
+    } else if (m_queue.empty()) {
+	m_dropping = false;
+    }
+
+    m_queue.push_back(QueuedBuffer { buffer, control });
+    if (m_writing.empty()) {
+	startWrite();
+    }
+}
+
+void
+DataConnection::startWrite()
+{
+    std::vector<boost::asio::const_buffer> buffers;
+
+    while (!m_queue.empty() && m_writing.size() < MaxBuffersPerWrite) {
+	m_writing.push_back(m_queue.front().buffer);
+	m_queue.pop_front();
+	buffers.push_back(boost::asio::buffer(*m_writing.back()));
+    }
+
+    boost::asio::async_write(m_socket, buffers,
+	boost::bind(&DataConnection::handleWrite, shared_from_this(),
+		    boost::asio::placeholders::error));
+}
+
+void
+DataConnection::handleWrite(const boost::system::error_code& error)
+{
+    m_writing.clear();
+
+    if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    m_handler.stopConnection(shared_from_this());
+	}
+	return;
     }
-    stream << type << " " << ValueApi::formatValue(value);
 
-    output(stream.str());
+    if (!m_queue.empty()) {
+	startWrite();
+    }
 }
@@ -20,7 +20,10 @@
 #ifndef __DATAHANDLER_H__
 #define __DATAHANDLER_H__
 
+#include <stdint.h>
+#include <deque>
 #include <set>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -29,12 +32,79 @@
 #include "Noncopyable.h"
 
 class DataHandler;
+class ValueCache;
+
+/*
+ * Data port protocol
+ *
+ * By default, every value is sent as a text line ("hk1 currenttemperature 21.5").
+ * A client can switch to binary framing by sending the line "binary". The
+ * collector discards the text lines it hasn't started writing yet and
+ * answers with the magic "EMSDAT" and a 1 byte format version; all
+ * following values are sent as binary records (integers little endian).
+ * Text lines already being written when the request arrives are sent
+ * completely before the magic, so clients skip whole lines until they
+ * read the magic:
+ *
+ * record: 2 byte value id (type * number of subtypes + subtype),
+ *         1 byte reading type, 1 byte flags (see RecordFlags),
+ *         8 byte sequence number, 8 byte monotonic timestamp (us),
+ *         2 byte payload length, payload
+ *
+ * The payload holds the raw reading as returned by ValueApi::formatRawValue,
+ * so it is empty for values without ValidFlag.
+ *
+ * Clients receive all values by default. "unsubscribe" stops all values,
+ * "subscribe <selector>" and "unsubscribe <selector>" add or remove values.
+ * The selector is either given like for the 'cache fetch' command
+ * ("hk1 currenttemperature", "hk1", "currenttemperature") or as a glob
+ * over subtype/type with * and ? ("hk?/currenttemperature", "hk1/current*",
+ * "none" being the subtype of values without one); an empty selector
+ * means all values.
+ *
+ * Every value the collector sends gets the next sequence number. After
+ * sending "snapshot", a client receives the cached values matching its
+ * subscription, all tagged with the sequence number of the last value
+ * the cache contains, followed by the live values with increasing sequence
+ * numbers. In text mode, the snapshot is framed by the lines
+ * "snapshot begin <seq>" and "snapshot end <seq>" and from then on every
+ * line is prefixed with its sequence number. In binary mode, snapshot
+ * records carry the snapshot flag and the snapshot ends with a record of
+ * value id SnapshotEndId without payload. Gaps in the sequence numbers
+ * are expected for filtered connections; for unfiltered ones they mean
+ * values were dropped.
+ */
+class DataProtocol
+{
+    public:
+	static const char Magic[6];
+	static const uint8_t Version = 2;
+	static const size_t RecordHeaderSize = 2 + 1 + 1 + 8 + 8 + 2;
+	static const size_t ValueIdCount = EmsValue::TypeLast * EmsValue::SubTypeLast;
+	static const uint16_t SnapshotEndId = 0xffff;
+
+	enum RecordFlags {
+	    ValidFlag = 1 << 0,
+	    SnapshotFlag = 1 << 1
+	};
+
+	static size_t valueId(EmsValue::Type type, EmsValue::SubType subtype) {
+	    return type * EmsValue::SubTypeLast + subtype;
+	}
+};
 
 class DataConnection : public boost::enable_shared_from_this<DataConnection>,
 		       private boost::noncopyable
 {
     public:
 	typedef boost::shared_ptr<DataConnection> Ptr;
+	/* formatted once, shared by all connections */
+	typedef boost::shared_ptr<const std::string> Buffer;
+
+	typedef enum {
+	    TextMode,
+	    BinaryMode
+	} Mode;
 
     public:
 	DataConnection(boost::asio::io_service& ios, DataHandler& handler);
@@ -47,25 +117,57 @@ class DataConnection : public boost::enable_shared_from_this<DataConnection>,
 	void close() {
 	    m_socket.close();
 	}
-	void handleValue(const EmsValue& value);
+	Mode mode() const {
+	    return m_mode;
+	}
+	bool isSequenced() const {
+	    return m_sequenced;
+	}
+	bool isSubscribed(size_t valueId) const {
+	    return m_subscription[valueId];
+	}
+	void start();
+	/* control buffers (binary header, snapshot) are never dropped for
+	 * slow clients, live values queued around them are dropped instead */
+	void send(const Buffer& buffer, bool control = false);
 
     private:
-	void handleWrite(const boost::system::error_code& error);
-
-	void output(const std::string& text) {
-	    boost::asio::async_write(m_socket, boost::asio::buffer(text + "\n"),
-		boost::bind(&DataConnection::handleWrite, shared_from_this(),
+	void startRead() {
+	    boost::asio::async_read_until(m_socket, m_request, "\n",
+		boost::bind(&DataConnection::handleRequest, shared_from_this(),
 			    boost::asio::placeholders::error));
 	}
+	void handleRequest(const boost::system::error_code& error);
+	void updateSubscription(const std::vector<std::string>& selector, bool subscribe);
+	void startWrite();
+	void handleWrite(const boost::system::error_code& error);
+
     private:
+	/* upper limit of buffers gathered into one write */
+	static const size_t MaxBuffersPerWrite = 64;
+
+	struct QueuedBuffer {
+	    Buffer buffer;
+	    bool control;
+	};
+
 	boost::asio::ip::tcp::socket m_socket;
 	DataHandler& m_handler;
+	boost::asio::streambuf m_request;
+	Mode m_mode;
+	bool m_sequenced;
+	/* indexed by value id */
+	std::vector<bool> m_subscription;
+	std::deque<QueuedBuffer> m_queue;
+	/* buffers of the write in progress, kept alive until it finished */
+	std::vector<Buffer> m_writing;
+	bool m_dropping;
 };
 
 class DataHandler : private boost::noncopyable
 {
     public:
-	DataHandler(boost::asio::io_service& ios,
+	DataHandler(boost::asio::io_service& ios, ValueCache *cache,
 		    boost::asio::ip::tcp::endpoint& endpoint);
 	~DataHandler();
 
@@ -73,8 +175,14 @@ class DataHandler : private boost::noncopyable
 	void startConnection(DataConnection::Ptr connection);
 	void stopConnection(DataConnection::Ptr connection);
 	void handleValue(const EmsValue& value);
+	void sendSnapshot(DataConnection::Ptr connection);
 
     private:
+	/* the append functions return false for values that can't be sent */
+	static bool appendText(std::string& out, const EmsValue& value,
+			       const uint64_t *sequence);
+	static bool appendBinary(std::string& out, const EmsValue& value,
+				 uint64_t sequence, uint64_t timestamp, uint8_t flags);
 	void handleAccept(DataConnection::Ptr connection,
 			  const boost::system::error_code& error);
 	void startAccepting();
@@ -83,6 +191,11 @@ class DataHandler : private boost::noncopyable
 	boost::asio::io_service& m_ios;
 	boost::asio::ip::tcp::acceptor m_acceptor;
 	std::set<DataConnection::Ptr> m_connections;
+	ValueCache *m_cache;
+	/* indexed by type, values of types without name aren't sent */
+	std::vector<bool> m_namedTypes;
+	/* sequence number of the last value */
+	uint64_t m_sequence;
 };
 
 #endif /* __DATAHANDLER_H__ */
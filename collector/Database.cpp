@@ -17,7 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <vector>
 #include <mysql++/exceptions.h>
 #include <mysql++/query.h>
 #include <mysql++/ssqls.h>
@@ -45,12 +49,21 @@ sql_create_4(StateSensorValue, 1, 4,
 	     mysqlpp::sql_datetime, endtime);
 
 Database::Database() :
-    m_connection(NULL)
+    m_sensors(StateSensorLast),
+    m_connection(NULL),
+    m_stopWriter(false),
+    m_queueFullWarned(false),
+    m_statsPending(false),
+    m_lastFlushLatency(0),
+    m_maxFlushLatency(0),
+    m_droppedValues(0)
 {
+    buildMappingIndex();
 }
 
 Database::~Database()
 {
+    stopWriter();
     if (m_connection) {
 	delete m_connection;
     }
@@ -99,6 +112,170 @@ Database::connect(const std::string& server, const std::string& user, const std:
     return success;
 }
 
+void
+Database::start()
+{
+    /* fork() only copies the calling thread, so this must be
+     * called after daemonizing */
+    if (m_connection && !m_writerThread.joinable()) {
+	m_writerThread = std::thread(&Database::writerLoop, this);
+    }
+}
+
+void
+Database::buildMappingIndex()
+{
+    static const struct {
+	EmsValue::Type type;
+	EmsValue::SubType subtype;
+	NumericSensors sensor;
+    } NUMERICMAPPING[] = {
+	{ EmsValue::SollTemp, EmsValue::Kessel, SensorKesselSollTemp },
+	{ EmsValue::IstTemp, EmsValue::Kessel, SensorKesselIstTemp },
+	{ EmsValue::SollTemp, EmsValue::WW, SensorWarmwasserSollTemp },
+	{ EmsValue::IstTemp, EmsValue::WW, SensorWarmwasserIstTemp },
+	{ EmsValue::SollTemp, EmsValue::HK1, SensorVorlaufHK1SollTemp },
+	{ EmsValue::IstTemp, EmsValue::HK1, SensorVorlaufHK1IstTemp },
+	{ EmsValue::SollTemp, EmsValue::HK2, SensorVorlaufHK2SollTemp },
+	{ EmsValue::IstTemp, EmsValue::HK2, SensorVorlaufHK2IstTemp },
+	{ EmsValue::IstTemp, EmsValue::Ruecklauf, SensorRuecklaufTemp },
+	{ EmsValue::IstTemp, EmsValue::Aussen, SensorAussenTemp },
+	{ EmsValue::GedaempfteTemp, EmsValue::Aussen, SensorGedaempfteAussenTemp },
+	{ EmsValue::RaumSollTemp, EmsValue::HK1, SensorRaumSollTemp },
+	{ EmsValue::RaumIstTemp, EmsValue::HK1, SensorRaumIstTemp },
+	{ EmsValue::Flammenstrom, EmsValue::None, SensorFlammenstrom },
+	{ EmsValue::Systemdruck, EmsValue::None, SensorSystemdruck },
+	{ EmsValue::IstTemp, EmsValue::Waermetauscher, SensorWaermetauscherTemp },
+	{ EmsValue::DurchflussMenge, EmsValue::WW, SensorWarmwasserDurchfluss },
+	{ EmsValue::IstTemp, EmsValue::SolarSpeicher, SensorSolarSpeicherTemp },
+	{ EmsValue::IstTemp, EmsValue::SolarKollektor, SensorSolarKollektorTemp }
+    };
+
+    static const struct {
+	EmsValue::Type type;
+	EmsValue::SubType subtype;
+	NumericSensors sensor;
+    } INTEGERMAPPING[] = {
+	{ EmsValue::BetriebsZeit, EmsValue::Kessel, SensorBetriebszeit },
+	{ EmsValue::HeizZeit, EmsValue::Kessel, SensorHeizZeit },
+	{ EmsValue::Brennerstarts, EmsValue::Kessel, SensorBrennerstarts },
+	{ EmsValue::WarmwasserbereitungsZeit, EmsValue::None, SensorWarmwasserbereitungsZeit },
+	{ EmsValue::WarmwasserBereitungen, EmsValue::None, SensorWarmwasserBereitungen },
+	{ EmsValue::Mischersteuerung, EmsValue::HK2, SensorMischersteuerung },
+	{ EmsValue::IstModulation, EmsValue::Brenner, SensorMomLeistung },
+	{ EmsValue::SollModulation, EmsValue::Brenner, SensorMaxLeistung },
+	{ EmsValue::IstModulation, EmsValue::KesselPumpe, SensorPumpenModulation }
+    };
+
+    static const struct {
+	EmsValue::Type type;
+	EmsValue::SubType subtype;
+	BooleanSensors sensor;
+    } BOOLMAPPING[] = {
+	{ EmsValue::FlammeAktiv, EmsValue::None, SensorFlamme },
+	{ EmsValue::BrennerAktiv, EmsValue::None, SensorBrenner },
+	{ EmsValue::ZuendungAktiv, EmsValue::None, SensorZuendung },
+	{ EmsValue::PumpeAktiv, EmsValue::Kessel, SensorKesselPumpe },
+	{ EmsValue::DreiWegeVentilAufWW, EmsValue::None, Sensor3WegeVentil },
+	{ EmsValue::Tagbetrieb, EmsValue::HK1, SensorHK1Tagbetrieb },
+	{ EmsValue::PumpeAktiv, EmsValue::HK1, SensorHK1Pumpe },
+	{ EmsValue::Ferien, EmsValue::HK1, SensorHK1Ferien },
+	{ EmsValue::Party, EmsValue::HK1, SensorHK1Party },
+	{ EmsValue::Tagbetrieb, EmsValue::HK2, SensorHK2Tagbetrieb },
+	{ EmsValue::PumpeAktiv, EmsValue::HK2, SensorHK2Pumpe },
+	{ EmsValue::Ferien, EmsValue::HK2, SensorHK2Ferien },
+	{ EmsValue::Party, EmsValue::HK2, SensorHK2Party },
+	{ EmsValue::WarmwasserBereitung, EmsValue::None, SensorWarmwasserBereitung },
+	{ EmsValue::WarmwasserTempOK, EmsValue::None, SensorWarmwasserTempOK },
+	{ EmsValue::ZirkulationAktiv, EmsValue::None, SensorZirkulation },
+	{ EmsValue::Tagbetrieb, EmsValue::Zirkulation, SensorZirkulationTagbetrieb },
+	{ EmsValue::WWVorrang, EmsValue::None, SensorWWVorrang },
+	{ EmsValue::Tagbetrieb, EmsValue::WW, SensorWWTagbetrieb },
+	{ EmsValue::Sommerbetrieb, EmsValue::None, SensorSommerbetrieb },
+	{ EmsValue::PumpeAktiv, EmsValue::Solar, SensorSolarPumpe }
+    };
+
+    static const struct {
+	EmsValue::Type type;
+	StateSensors sensor;
+    } STATEMAPPING[] = {
+	{ EmsValue::FehlerCode, SensorFehlerCode },
+	{ EmsValue::ServiceCode, SensorServiceCode },
+	{ EmsValue::StoerungsCode, SensorStoerungsCode },
+	{ EmsValue::StoerungsNummer, SensorStoerungsNummer },
+    };
+
+    /* Resolves a type/subtype pair the same way a linear scan over the
+     * tables would, so that the first matching entry wins. */
+    auto resolve = [&] (size_t type, size_t subtype) {
+	SensorMapping result = { MappingNone, 0 };
+
+	for (auto& entry : NUMERICMAPPING) {
+	    if (type == (size_t) entry.type && subtype == (size_t) entry.subtype) {
+		result.kind = MappingNumeric;
+		result.sensor = entry.sensor;
+		return result;
+	    }
+	}
+	for (auto& entry : INTEGERMAPPING) {
+	    if (type == (size_t) entry.type && subtype == (size_t) entry.subtype) {
+		result.kind = MappingInteger;
+		result.sensor = entry.sensor;
+		return result;
+	    }
+	}
+	for (auto& entry : BOOLMAPPING) {
+	    if (type == (size_t) entry.type) {
+		if (entry.subtype == EmsValue::None || subtype == (size_t) entry.subtype) {
+		    result.kind = MappingBoolean;
+		    result.sensor = entry.sensor;
+		    return result;
+		}
+	    }
+	}
+	for (auto& entry : STATEMAPPING) {
+	    if (type == (size_t) entry.type) {
+		result.kind = MappingState;
+		result.sensor = entry.sensor;
+		return result;
+	    }
+	}
+	if (type == EmsValue::Betriebsart && (subtype == EmsValue::HK1 || subtype == EmsValue::HK2)) {
+	    result.kind = MappingBetriebsart;
+	    result.sensor = subtype == EmsValue::HK2 ? SensorHK2Automatik : SensorHK1Automatik;
+	}
+	return result;
+    };
+
+    size_t maxType = EmsValue::Betriebsart, maxSubType = EmsValue::HK2;
+    for (auto& entry : NUMERICMAPPING) {
+	maxType = std::max<size_t>(maxType, entry.type);
+	maxSubType = std::max<size_t>(maxSubType, entry.subtype);
+    }
+    for (auto& entry : INTEGERMAPPING) {
+	maxType = std::max<size_t>(maxType, entry.type);
+	maxSubType = std::max<size_t>(maxSubType, entry.subtype);
+    }
+    for (auto& entry : BOOLMAPPING) {
+	maxType = std::max<size_t>(maxType, entry.type);
+	maxSubType = std::max<size_t>(maxSubType, entry.subtype);
+    }
+    for (auto& entry : STATEMAPPING) {
+	maxType = std::max<size_t>(maxType, entry.type);
+    }
+
+    /* one extra column for all subtypes that no table mentions */
+    m_mappingTypes = maxType + 1;
+    m_mappingSubTypes = maxSubType + 2;
+    m_mappingIndex.resize(m_mappingTypes * m_mappingSubTypes);
+
+    for (size_t type = 0; type < m_mappingTypes; type++) {
+	for (size_t subtype = 0; subtype < m_mappingSubTypes; subtype++) {
+	    m_mappingIndex[type * m_mappingSubTypes + subtype] = resolve(type, subtype);
+	}
+    }
+}
+
 bool
 Database::createTables()
 {
@@ -286,7 +463,6 @@ Database::createSensorRows()
 bool
 Database::checkAndUpdateRateLimit(unsigned int sensor, time_t now)
 {
-    std::map<unsigned int, time_t>::iterator iter;
     int limit = Options::rateLimit();
 
     if (limit == 0) {
@@ -294,153 +470,336 @@ Database::checkAndUpdateRateLimit(unsigned int sensor, time_t now)
 	return true;
     }
 
-    iter = m_lastWrites.find(sensor);
-    if (iter != m_lastWrites.end()) {
-	time_t difference = now - iter->second;
-	if (difference < limit) {
-	    return false;
-	}
+    SensorState& state = m_sensors[sensor];
+    if (state.lastWrite != 0 && now - state.lastWrite < limit) {
+	return false;
     }
 
-    m_lastWrites[sensor] = now;
+    state.lastWrite = now;
     return true;
 }
 
-bool
-Database::executeQuery(mysqlpp::Query& query)
+void
+Database::queueOperation(Operation& op)
 {
-    try {
-	query.execute();
-	return true;
-    } catch (const mysqlpp::BadQuery& e) {
-	std::cerr << "MySQL query error: " << e.what() << std::endl;
-    } catch (const mysqlpp::Exception& e) {
-	std::cerr << "MySQL exception: " << e.what() << std::endl;
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+
+    if (m_queue.size() >= Options::databaseQueueSize()) {
+	m_droppedValues++;
+	if (!m_queueFullWarned) {
+	    std::cerr << "Database write queue is full, dropping sensor values" << std::endl;
+	    m_queueFullWarned = true;
+	}
+	return;
     }
 
-    return false;
+    m_queueFullWarned = false;
+    m_queue.push_back(std::move(op));
+    if (m_queue.size() >= FlushThreshold) {
+	m_queueCondition.notify_one();
+    }
+}
+
+size_t
+Database::queueDepth()
+{
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    return m_queue.size();
 }
 
 void
-Database::handleValue(const EmsValue& value)
+Database::stopWriter()
 {
-    static const struct {
-	EmsValue::Type type;
-	EmsValue::SubType subtype;
-	NumericSensors sensor;
-    } NUMERICMAPPING[] = {
-	{ EmsValue::SollTemp, EmsValue::Kessel, SensorKesselSollTemp },
-	{ EmsValue::IstTemp, EmsValue::Kessel, SensorKesselIstTemp },
-	{ EmsValue::SollTemp, EmsValue::WW, SensorWarmwasserSollTemp },
-	{ EmsValue::IstTemp, EmsValue::WW, SensorWarmwasserIstTemp },
-	{ EmsValue::SollTemp, EmsValue::HK1, SensorVorlaufHK1SollTemp },
-	{ EmsValue::IstTemp, EmsValue::HK1, SensorVorlaufHK1IstTemp },
-	{ EmsValue::SollTemp, EmsValue::HK2, SensorVorlaufHK2SollTemp },
-	{ EmsValue::IstTemp, EmsValue::HK2, SensorVorlaufHK2IstTemp },
-	{ EmsValue::IstTemp, EmsValue::Ruecklauf, SensorRuecklaufTemp },
-	{ EmsValue::IstTemp, EmsValue::Aussen, SensorAussenTemp },
-	{ EmsValue::GedaempfteTemp, EmsValue::Aussen, SensorGedaempfteAussenTemp },
-	{ EmsValue::RaumSollTemp, EmsValue::HK1, SensorRaumSollTemp },
-	{ EmsValue::RaumIstTemp, EmsValue::HK1, SensorRaumIstTemp },
-	{ EmsValue::Flammenstrom, EmsValue::None, SensorFlammenstrom },
-	{ EmsValue::Systemdruck, EmsValue::None, SensorSystemdruck },
-	{ EmsValue::IstTemp, EmsValue::Waermetauscher, SensorWaermetauscherTemp },
-	{ EmsValue::DurchflussMenge, EmsValue::WW, SensorWarmwasserDurchfluss },
-	{ EmsValue::IstTemp, EmsValue::SolarSpeicher, SensorSolarSpeicherTemp },
-	{ EmsValue::IstTemp, EmsValue::SolarKollektor, SensorSolarKollektorTemp }
-    };
+    if (!m_writerThread.joinable()) {
+	return;
+    }
 
-    static const struct {
-	EmsValue::Type type;
-	EmsValue::SubType subtype;
-	NumericSensors sensor;
-    } INTEGERMAPPING[] = {
-	{ EmsValue::BetriebsZeit, EmsValue::Kessel, SensorBetriebszeit },
-	{ EmsValue::HeizZeit, EmsValue::Kessel, SensorHeizZeit },
-	{ EmsValue::Brennerstarts, EmsValue::Kessel, SensorBrennerstarts },
-	{ EmsValue::WarmwasserbereitungsZeit, EmsValue::None, SensorWarmwasserbereitungsZeit },
-	{ EmsValue::WarmwasserBereitungen, EmsValue::None, SensorWarmwasserBereitungen },
-	{ EmsValue::Mischersteuerung, EmsValue::HK2, SensorMischersteuerung },
-	{ EmsValue::IstModulation, EmsValue::Brenner, SensorMomLeistung },
-	{ EmsValue::SollModulation, EmsValue::Brenner, SensorMaxLeistung },
-	{ EmsValue::IstModulation, EmsValue::KesselPumpe, SensorPumpenModulation }
-    };
+    {
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	m_stopWriter = true;
+    }
+    m_queueCondition.notify_one();
+    m_writerThread.join();
 
-    static const struct {
-	EmsValue::Type type;
-	EmsValue::SubType subtype;
-	BooleanSensors sensor;
-    } BOOLMAPPING[] = {
-	{ EmsValue::FlammeAktiv, EmsValue::None, SensorFlamme },
-	{ EmsValue::BrennerAktiv, EmsValue::None, SensorBrenner },
-	{ EmsValue::ZuendungAktiv, EmsValue::None, SensorZuendung },
-	{ EmsValue::PumpeAktiv, EmsValue::Kessel, SensorKesselPumpe },
-	{ EmsValue::DreiWegeVentilAufWW, EmsValue::None, Sensor3WegeVentil },
-	{ EmsValue::Tagbetrieb, EmsValue::HK1, SensorHK1Tagbetrieb },
-	{ EmsValue::PumpeAktiv, EmsValue::HK1, SensorHK1Pumpe },
-	{ EmsValue::Ferien, EmsValue::HK1, SensorHK1Ferien },
-	{ EmsValue::Party, EmsValue::HK1, SensorHK1Party },
-	{ EmsValue::Tagbetrieb, EmsValue::HK2, SensorHK2Tagbetrieb },
-	{ EmsValue::PumpeAktiv, EmsValue::HK2, SensorHK2Pumpe },
-	{ EmsValue::Ferien, EmsValue::HK2, SensorHK2Ferien },
-	{ EmsValue::Party, EmsValue::HK2, SensorHK2Party },
-	{ EmsValue::WarmwasserBereitung, EmsValue::None, SensorWarmwasserBereitung },
-	{ EmsValue::WarmwasserTempOK, EmsValue::None, SensorWarmwasserTempOK },
-	{ EmsValue::ZirkulationAktiv, EmsValue::None, SensorZirkulation },
-	{ EmsValue::Tagbetrieb, EmsValue::Zirkulation, SensorZirkulationTagbetrieb },
-	{ EmsValue::WWVorrang, EmsValue::None, SensorWWVorrang },
-	{ EmsValue::Tagbetrieb, EmsValue::WW, SensorWWTagbetrieb },
-	{ EmsValue::Sommerbetrieb, EmsValue::None, SensorSommerbetrieb },
-	{ EmsValue::PumpeAktiv, EmsValue::Solar, SensorSolarPumpe }
-    };
+    /* the io thread is gone as well, print the stats of the final flush */
+    if (m_statsPending) {
+	printPendingStats();
+    }
+}
 
-    static const struct {
-	EmsValue::Type type;
-	StateSensors sensor;
-    } STATEMAPPING[] = {
-	{ EmsValue::FehlerCode, SensorFehlerCode },
-	{ EmsValue::ServiceCode, SensorServiceCode },
-	{ EmsValue::StoerungsCode, SensorStoerungsCode },
-	{ EmsValue::StoerungsNummer, SensorStoerungsNummer },
-    };
+void
+Database::writerLoop()
+{
+    std::chrono::seconds interval(std::max(Options::databaseFlushInterval(), 1U));
+    time_t lastCheckpoint = time(NULL);
+    std::unique_lock<std::mutex> lock(m_queueMutex);
 
-    if (!value.isValid()) {
-	return;
+    mysqlpp::Connection::thread_start();
+
+    while (true) {
+	m_queueCondition.wait_for(lock, interval, [this] {
+	    return m_stopWriter || m_queue.size() >= FlushThreshold;
+	});
+
+	time_t now = time(NULL);
+	bool checkpoint = m_stopWriter ||
+		now - lastCheckpoint >= (time_t) Options::databaseCheckpointInterval();
+
+	if (!m_queue.empty() || checkpoint) {
+	    std::deque<Operation> ops;
+	    ops.swap(m_queue);
+
+	    /* don't block the io thread while talking to the DB */
+	    lock.unlock();
+	    flush(ops, checkpoint);
+	    lock.lock();
+
+	    if (checkpoint) {
+		lastCheckpoint = now;
+	    }
+	}
+
+	if (m_stopWriter) {
+	    break;
+	}
     }
 
-    EmsValue::Type type = value.getType();
-    EmsValue::SubType subtype = value.getSubType();
+    lock.unlock();
+    mysqlpp::Connection::thread_end();
+}
 
-    for (size_t i = 0; i < sizeof(NUMERICMAPPING) / sizeof(NUMERICMAPPING[0]); i++) {
-	if (type == NUMERICMAPPING[i].type && subtype == NUMERICMAPPING[i].subtype) {
-	    addSensorValue(NUMERICMAPPING[i].sensor, value.getValue<float>());
+void
+Database::flush(const std::deque<Operation>& ops, bool checkpoint)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t inserts = 0, updates = 0;
+
+    if (ops.empty() && checkpoint) {
+	bool haveDirty = false;
+	for (auto& state : m_sensors) {
+	    haveDirty = haveDirty || state.intervalDirty;
+	}
+	if (!haveDirty) {
 	    return;
 	}
     }
-    for (size_t i = 0; i < sizeof(INTEGERMAPPING) / sizeof(INTEGERMAPPING[0]); i++) {
-	if (type == INTEGERMAPPING[i].type && subtype == INTEGERMAPPING[i].subtype) {
-	    addSensorValue(INTEGERMAPPING[i].sensor, value.getValue<unsigned int>());
-	    return;
+
+    /* The tables are MyISAM, which ignores transactions, so a flush
+     * isn't atomic: a failing statement leaves the ones before it (and
+     * possibly part of a multi-row insert) applied. The batch is never
+     * retried, as that would duplicate the rows that made it. */
+    try {
+	flushTable<NumericSensorValue>(numericTableName, ops, sensorTypeNumeric,
+				       &Operation::numericValue, &SensorState::numericValue,
+				       checkpoint, inserts, updates);
+	flushTable<BooleanSensorValue>(booleanTableName, ops, sensorTypeBoolean,
+				       &Operation::booleanValue, &SensorState::booleanValue,
+				       checkpoint, inserts, updates);
+	flushTable<StateSensorValue>(stateTableName, ops, sensorTypeState,
+				     &Operation::stateValue, &SensorState::stateValue,
+				     checkpoint, inserts, updates);
+
+	if (checkpoint) {
+	    for (auto& state : m_sensors) {
+		state.intervalDirty = false;
+	    }
 	}
+    } catch (const mysqlpp::Exception& e) {
+	std::cerr << "MySQL exception: " << e.what() << std::endl;
+
+	/* we don't know which rows made it into the DB, so drop the
+	 * batch and start new rows for all affected sensors with the
+	 * next values */
+	for (auto& op : ops) {
+	    SensorState& state = m_sensors[op.sensor];
+	    state.haveValue = false;
+	    state.intervalOpen = false;
+	    state.intervalDirty = false;
+	}
+    }
+
+    unsigned int latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+	    std::chrono::steady_clock::now() - start).count();
+    m_lastFlushLatency = latency;
+    if (latency > m_maxFlushLatency) {
+	m_maxFlushLatency = latency;
+    }
+
+    if (Options::statsDebug()) {
+	std::ostringstream line;
+	line << "DB: flushed " << ops.size() << " values ("
+	     << inserts << " inserts, " << updates << " updates"
+	     << (checkpoint ? ", checkpoint" : "") << ") in "
+	     << latency << " ms, queue depth " << queueDepth()
+	     << ", dropped " << m_droppedValues << std::endl;
+
+	/* the debug streams belong to the io thread, which prints it */
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	m_pendingStats += line.str();
+	m_statsPending = true;
     }
-    for (size_t i = 0; i < sizeof(BOOLMAPPING) / sizeof(BOOLMAPPING[0]); i++) {
-	if (type == BOOLMAPPING[i].type) {
-	    if (BOOLMAPPING[i].subtype == EmsValue::None || subtype == BOOLMAPPING[i].subtype) {
-		addSensorValue(BOOLMAPPING[i].sensor, value.getValue<bool>());
-		return;
+}
+
+template<typename Row, typename T> void
+Database::flushTable(const char *table, const std::deque<Operation>& ops,
+		     unsigned int sensorType, T Operation::*opMember,
+		     T SensorState::*stateMember, bool checkpoint,
+		     size_t& inserts, size_t& updates)
+{
+    std::vector<Row> rows;
+    std::map<unsigned int, size_t> pendingRows;
+    std::map<mysqlpp::ulonglong, time_t> endTimes;
+
+    /* A value that didn't change only extends the open interval of its
+     * sensor in memory. The end time of an open interval is written when
+     * the value changes (closing the interval) or on checkpoints. */
+    for (auto& op : ops) {
+	if (op.sensorType != sensorType) {
+	    continue;
+	}
+
+	const T& value = op.*opMember;
+	SensorState& state = m_sensors[op.sensor];
+	mysqlpp::sql_datetime timestamp(op.timestamp);
+	auto pendingIter = pendingRows.find(op.sensor);
+	bool valueChanged = !state.haveValue || state.*stateMember != value;
+
+	if (pendingIter != pendingRows.end()) {
+	    rows[pendingIter->second].endtime = timestamp;
+	} else if (!state.intervalOpen) {
+	    valueChanged = true;
+	} else if (!valueChanged) {
+	    state.intervalEndTime = op.timestamp;
+	    state.intervalDirty = true;
+	} else {
+	    endTimes[state.intervalId] = op.timestamp;
+	    state.intervalOpen = false;
+	    state.intervalDirty = false;
+	}
+
+	if (valueChanged) {
+	    pendingRows[op.sensor] = rows.size();
+	    rows.push_back(Row(op.sensor, value, timestamp, timestamp));
+	    state.sensorType = sensorType;
+	    state.haveValue = true;
+	    state.*stateMember = value;
+	}
+    }
+
+    if (checkpoint) {
+	for (auto& state : m_sensors) {
+	    if (state.sensorType == sensorType && state.intervalDirty) {
+		endTimes[state.intervalId] = state.intervalEndTime;
 	    }
 	}
     }
-    for (size_t i = 0; i < sizeof(STATEMAPPING) / sizeof(STATEMAPPING[0]); i++) {
-	if (type == STATEMAPPING[i].type) {
-	    addSensorValue(STATEMAPPING[i].sensor, value.getValue<std::string>());
-	    return;
+
+    std::map<time_t, std::vector<mysqlpp::ulonglong> > idsByEndTime;
+    for (auto& entry : endTimes) {
+	idsByEndTime[entry.second].push_back(entry.first);
+    }
+
+    for (auto& entry : idsByEndTime) {
+	mysqlpp::Query query = m_connection->query();
+
+	query << "update " << table << " set endtime ='"
+	      << mysqlpp::sql_datetime(entry.first) << "' where id in (";
+	for (size_t i = 0; i < entry.second.size(); i++) {
+	    query << (i == 0 ? "" : ",") << entry.second[i];
 	}
+	query << ")";
+	query.execute();
+	updates += entry.second.size();
     }
 
-    if (type == EmsValue::Betriebsart && (subtype == EmsValue::HK1 || subtype == EmsValue::HK2)) {
-	BooleanSensors sensor = subtype == EmsValue::HK2 ? SensorHK2Automatik : SensorHK1Automatik;
-	addSensorValue(sensor, value.getValue<uint8_t>() == 2);
+    if (!rows.empty()) {
+	mysqlpp::Query query = m_connection->query();
+
+	query.insert(rows.begin(), rows.end());
+	query.execute();
+	inserts += rows.size();
+
+	/* The ids of a multi-row insert are only consecutive if the engine
+	 * allocates them in one go (not the case for InnoDB in interleaved
+	 * lock mode), so read them back. insert_id() is the id of the first
+	 * row. A sensor whose value changed several times within the batch
+	 * got several new rows; only the last one is still open, and that
+	 * is the one with the highest id from insert_id() on. */
+	mysqlpp::ulonglong firstId = query.insert_id();
+	mysqlpp::Query idQuery = m_connection->query();
+
+	idQuery << "select sensor, max(id) from " << table
+		<< " where id >= " << firstId << " and sensor in (";
+	for (auto iter = pendingRows.begin(); iter != pendingRows.end(); ++iter) {
+	    idQuery << (iter == pendingRows.begin() ? "" : ",") << iter->first;
+	}
+	idQuery << ") group by sensor";
+
+	mysqlpp::StoreQueryResult res = idQuery.store();
+	for (size_t i = 0; res && i < res.num_rows(); i++) {
+	    auto entry = pendingRows.find((unsigned int) res[i][0]);
+	    if (entry == pendingRows.end()) {
+		continue;
+	    }
+
+	    SensorState& state = m_sensors[entry->first];
+	    state.intervalOpen = true;
+	    state.intervalId = (mysqlpp::ulonglong) res[i][1];
+	    state.intervalEndTime = time_t(rows[entry->second].endtime);
+	    state.intervalDirty = false;
+	}
+    }
+}
+
+void
+Database::printPendingStats()
+{
+    std::string stats;
+
+    {
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	stats.swap(m_pendingStats);
+	m_statsPending = false;
+    }
+    Options::statsDebug() << stats;
+}
+
+void
+Database::handleValue(const EmsValue& value)
+{
+    if (m_statsPending) {
+	printPendingStats();
+    }
+
+    if (!value.isValid()) {
+	return;
+    }
+
+    size_t type = value.getType();
+    size_t subtype = std::min<size_t>(value.getSubType(), m_mappingSubTypes - 1);
+    if (type >= m_mappingTypes) {
+	return;
+    }
+
+    const SensorMapping& mapping = m_mappingIndex[type * m_mappingSubTypes + subtype];
+    switch (mapping.kind) {
+	case MappingNumeric:
+	    addSensorValue((NumericSensors) mapping.sensor, value.getValue<float>());
+	    break;
+	case MappingInteger:
+	    addSensorValue((NumericSensors) mapping.sensor, value.getValue<unsigned int>());
+	    break;
+	case MappingBoolean:
+	    addSensorValue((BooleanSensors) mapping.sensor, value.getValue<bool>());
+	    break;
+	case MappingState:
+	    addSensorValue((StateSensors) mapping.sensor, value.getValue<std::string>());
+	    break;
+	case MappingBetriebsart:
+	    addSensorValue((BooleanSensors) mapping.sensor, value.getValue<uint8_t>() == 2);
+	    break;
+	case MappingNone:
+	    break;
     }
 }
 
@@ -452,88 +811,28 @@ Database::addSensorValue(NumericSensors sensor, float value)
 	return;
     }
 
-    mysqlpp::Query query = m_connection->query();
-    std::map<unsigned int, float>::iterator cacheIter = m_numericCache.find(sensor);
-    std::map<unsigned int, mysqlpp::ulonglong>::iterator idIter = m_lastInsertIds.find(sensor);
-    bool valueChanged = cacheIter == m_numericCache.end() || cacheIter->second != value;
-    bool idValid = idIter != m_lastInsertIds.end() && idIter->second != 0;
-    mysqlpp::sql_datetime timestamp(now);
-
-    if (idValid) {
-	query << "update " << numericTableName << " set endtime ='" << timestamp
-	      << "' where id = " << idIter->second;
-	executeQuery(query);
-    }
-
-    if (valueChanged || !idValid) {
-	NumericSensorValue row(sensor, value, timestamp, timestamp);
-	query.insert(row);
-	if (executeQuery(query)) {
-	    m_lastInsertIds[sensor] = query.insert_id();
-	    m_numericCache[sensor] = value;
-	}
-    }
+    Operation op = { sensor, sensorTypeNumeric, value, false, std::string(), now };
+    queueOperation(op);
 }
 
 void
 Database::addSensorValue(BooleanSensors sensor, bool value)
 {
-    time_t now = time(NULL);
     if (!m_connection) {
 	return;
     }
 
-    mysqlpp::Query query = m_connection->query();
-    std::map<unsigned int, bool>::iterator cacheIter = m_booleanCache.find(sensor);
-    std::map<unsigned int, mysqlpp::ulonglong>::iterator idIter = m_lastInsertIds.find(sensor);
-    bool valueChanged = cacheIter == m_booleanCache.end() || cacheIter->second != value;
-    bool idValid = idIter != m_lastInsertIds.end() && idIter->second != 0;
-    mysqlpp::sql_datetime timestamp(now);
-
-    if (idValid) {
-	query << "update " << booleanTableName << " set endtime ='" << timestamp
-	      << "' where id = " << idIter->second;
-	executeQuery(query);
-    }
-
-    if (valueChanged || !idValid) {
-	BooleanSensorValue row(sensor, value, timestamp, timestamp);
-	query.insert(row);
-	if (executeQuery(query)) {
-	    m_lastInsertIds[sensor] = query.insert_id();
-	    m_booleanCache[sensor] = value;
-	}
-    }
+    Operation op = { sensor, sensorTypeBoolean, 0, value, std::string(), time(NULL) };
+    queueOperation(op);
 }
 
 void
 Database::addSensorValue(StateSensors sensor, const std::string& value)
 {
-    time_t now = time(NULL);
     if (!m_connection) {
 	return;
     }
 
-    mysqlpp::Query query = m_connection->query();
-    std::map<unsigned int, std::string>::iterator cacheIter = m_stateCache.find(sensor);
-    std::map<unsigned int, mysqlpp::ulonglong>::iterator idIter = m_lastInsertIds.find(sensor);
-    bool valueChanged = cacheIter == m_stateCache.end() || cacheIter->second != value;
-    bool idValid = idIter != m_lastInsertIds.end() && idIter->second != 0;
-    mysqlpp::sql_datetime timestamp(now);
-
-    if (idValid) {
-	query << "update " << stateTableName << " set endtime ='" << timestamp
-	      << "' where id = " << idIter->second;
-	executeQuery(query);
-    }
-
-    if (valueChanged || !idValid) {
-	StateSensorValue row(sensor, value, timestamp, timestamp);
-	query.insert(row);
-	if (executeQuery(query)) {
-	    m_lastInsertIds[sensor] = query.insert_id();
-	    m_stateCache[sensor] = value;
-	}
-    }
+    Operation op = { sensor, sensorTypeState, 0, false, value, time(NULL) };
+    queueOperation(op);
 }
-
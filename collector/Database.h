@@ -20,8 +20,14 @@
 #ifndef __DATABASE_H__
 #define __DATABASE_H__
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <queue>
+#include <thread>
+#include <vector>
 #include <mysql++/connection.h>
 #include <mysql++/query.h>
 #include "EmsMessage.h"
@@ -33,8 +39,22 @@ class Database {
 
     public:
 	bool connect(const std::string& server, const std::string& user, const std::string& password,  const std::string& dbName);
+	/* starts the writer thread, values are queued until then */
+	void start();
 	void handleValue(const EmsValue& value);
 
+	size_t queueDepth();
+	/* flush latencies in ms */
+	unsigned int lastFlushLatency() const {
+	    return m_lastFlushLatency;
+	}
+	unsigned int maxFlushLatency() const {
+	    return m_maxFlushLatency;
+	}
+	unsigned long droppedValues() const {
+	    return m_droppedValues;
+	}
+
     private:
 	typedef enum {
 	    SensorKesselSollTemp = 1,
@@ -111,10 +131,61 @@ class Database {
 	void addSensorValue(StateSensors sensor, const std::string& value);
 
     private:
+	struct Operation {
+	    unsigned int sensor;
+	    unsigned int sensorType;
+	    float numericValue;
+	    bool booleanValue;
+	    std::string stateValue;
+	    time_t timestamp;
+	};
+
+	typedef enum {
+	    MappingNone,
+	    MappingNumeric,
+	    MappingInteger,
+	    MappingBoolean,
+	    MappingState,
+	    MappingBetriebsart
+	} MappingKind;
+
+	struct SensorMapping {
+	    MappingKind kind;
+	    unsigned int sensor;
+	};
+
+	struct SensorState {
+	    /* only accessed from the io thread */
+	    time_t lastWrite;
+
+	    /* only accessed from the writer thread */
+	    unsigned int sensorType;
+	    bool haveValue;
+	    float numericValue;
+	    bool booleanValue;
+	    std::string stateValue;
+
+	    /* the last row of the sensor, whose end time grows as long as the value stays the same */
+	    bool intervalOpen;
+	    mysqlpp::ulonglong intervalId;
+	    time_t intervalEndTime;
+	    /* intervalEndTime is newer than the one stored in the DB */
+	    bool intervalDirty;
+	};
+
+	void buildMappingIndex();
 	bool createTables();
 	void createSensorRows();
 	bool checkAndUpdateRateLimit(unsigned int sensor, time_t now);
-	bool executeQuery(mysqlpp::Query& query);
+	void queueOperation(Operation& op);
+	void printPendingStats();
+	void stopWriter();
+	void writerLoop();
+	void flush(const std::deque<Operation>& ops, bool checkpoint);
+	template<typename Row, typename T> void flushTable(const char *table,
+		const std::deque<Operation>& ops, unsigned int sensorType,
+		T Operation::*opMember, T SensorState::*stateMember,
+		bool checkpoint, size_t& inserts, size_t& updates);
 
     private:
 	static const char *numericTableName;
@@ -134,12 +205,31 @@ class Database {
 	static const unsigned int readingTypeCount = 6;
 	static const unsigned int readingTypeFlowRate = 7;
 
-	std::map<unsigned int, time_t> m_lastWrites;
-	std::map<unsigned int, float> m_numericCache;
-	std::map<unsigned int, bool> m_booleanCache;
-	std::map<unsigned int, std::string> m_stateCache;
-	std::map<unsigned int, mysqlpp::ulonglong> m_lastInsertIds;
+	/* number of queued values that wakes up the writer before the flush interval expired */
+	static const size_t FlushThreshold = 500;
+
+	/* indexed by type * m_mappingSubTypes + subtype, the last
+	 * subtype column covers all subtypes not used by any mapping */
+	std::vector<SensorMapping> m_mappingIndex;
+	size_t m_mappingTypes;
+	size_t m_mappingSubTypes;
+
+	/* indexed by sensor number */
+	std::vector<SensorState> m_sensors;
 	mysqlpp::Connection *m_connection;
+
+	std::thread m_writerThread;
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueCondition;
+	std::deque<Operation> m_queue;
+	bool m_stopWriter;
+	bool m_queueFullWarned;
+	/* stats lines of the writer thread, printed from the io thread */
+	std::string m_pendingStats;
+	std::atomic<bool> m_statsPending;
+	std::atomic<unsigned int> m_lastFlushLatency;
+	std::atomic<unsigned int> m_maxFlushLatency;
+	std::atomic<unsigned long> m_droppedValues;
 };
 
 #endif /* __DATABASE_H__ */
@@ -141,44 +141,64 @@ EmsValue::EmsValue(Type type, SubType subType, const std::string& value) :
 {
 }
 
-EmsMessage::EmsMessage(ValueHandler& valueHandler, CacheAccessor cacheAccessor,
-		       const std::vector<uint8_t>& data) :
-    m_valueHandler(valueHandler),
-    m_cacheAccessor(cacheAccessor),
-    m_data(data),
+EmsValue::EmsValue(Type type, SubType subType, ReadingType readingType,
+		   const Reading& value, bool isValid) :
+    m_type(type),
+    m_subType(subType),
+    m_readingType(readingType),
+    m_value(value),
+    m_isValid(isValid)
+{
+}
+
+EmsMessage::EmsMessage(const ValueHandler& valueHandler, const CacheAccessor& cacheAccessor,
+		       uint8_t *frame, size_t length) :
+    m_valueHandler(&valueHandler),
+    m_cacheAccessor(&cacheAccessor),
+    m_data(frame, length),
     m_source(0),
     m_dest(0),
     m_type(0),
     m_extType(0),
     m_offset(0)
 {
-    if (m_data.size() < 4) {
+    if (length < 4) {
 	return;
     }
 
-    bool isRead = ((m_data[1] & 0x80) == 0);
-    bool isPlus = m_data[2] >= 0xf0 && m_data.size() >= (isRead ? 7 : 6);
+    bool isRead = ((frame[1] & 0x80) == 0);
+    bool isPlus = frame[2] >= 0xf0 && length >= (isRead ? 7 : 6);
 
-    m_source = m_data[0];
-    m_dest = m_data[1];
-    m_type = m_data[2];
-    m_offset = m_data[3];
-    m_data.erase(m_data.begin(), m_data.begin() + 4);
+    m_source = frame[0];
+    m_dest = frame[1];
+    m_type = frame[2];
+    m_offset = frame[3];
+    frame += 4;
+    length -= 4;
 
     if (isPlus) {
-	size_t start = isRead ? 0 : 1;
-	m_extType = (m_data[start] << 8) | m_data[start + 1];
-	m_data.erase(m_data.begin() + start, m_data.begin() + start + 2);
-
-
+	if (isRead) {
+	    m_extType = (frame[0] << 8) | frame[1];
+	} else {
+	    /* the first payload byte precedes the extended type, move it
+	     * next to the remaining payload instead of shifting that */
+	    m_extType = (frame[1] << 8) | frame[2];
+	    frame[2] = frame[0];
+	}
+	frame += 2;
+	length -= 2;
     }
+
+    m_data = Payload(frame, length);
 }
 
 EmsMessage::EmsMessage(uint8_t dest, uint16_t type, uint8_t offset,
 		       const std::vector<uint8_t>& data,
 		       bool expectResponse) :
-    m_valueHandler(),
-    m_data(data),
+    m_valueHandler(NULL),
+    m_cacheAccessor(NULL),
+    m_ownedData(data),
+    m_data(m_ownedData.data(), m_ownedData.size()),
     m_source(EmsProto::addressPC),
     m_dest(expectResponse ? dest | 0x80 : dest & 0x7f),
 
@@ -190,6 +210,33 @@ EmsMessage::EmsMessage(uint8_t dest, uint16_t type, uint8_t offset,
 {
 }
 
+EmsMessage::EmsMessage(const EmsMessage& other)
+{
+    *this = other;
+}
+
+EmsMessage&
+EmsMessage::operator=(const EmsMessage& other)
+{
+    if (this == &other) {
+	return *this;
+    }
+
+    m_valueHandler = other.m_valueHandler;
+    m_cacheAccessor = other.m_cacheAccessor;
+    /* a received message only views the read buffer, which is reused
+     * after the callbacks ran; copies may be kept longer, so they always
+     * get their own payload */
+    m_ownedData.assign(other.m_data.begin(), other.m_data.end());
+    m_data = Payload(m_ownedData.data(), m_ownedData.size());
+    m_source = other.m_source;
+    m_dest = other.m_dest;
+    m_type = other.m_type;
+    m_extType = other.m_extType;
+    m_offset = other.m_offset;
+    return *this;
+}
+
 std::vector<uint8_t>
 EmsMessage::getSendData(bool omitSenderAddress) const
 {
@@ -273,7 +320,7 @@ EmsMessage::handle()
 	debug << std::endl;
     }
 
-    if (!m_valueHandler) {
+    if (!m_valueHandler || !*m_valueHandler) {
 	/* kind of pointless to parse in that case */
 	return;
     }
@@ -338,7 +385,7 @@ EmsMessage::parseEnum(size_t offset, EmsValue::Type type, EmsValue::SubType subt
 {
     if (canAccess(offset, 1)) {
 	EmsValue value(type, subtype, m_data[offset - m_offset]);
-	m_valueHandler(value);
+	(*m_valueHandler)(value);
     }
 }
 
@@ -350,7 +397,7 @@ EmsMessage::parseNumeric(size_t offset, size_t size, int divider,
     if (canAccess(offset, size)) {
 	EmsValue value(type, subtype, &m_data.at(offset - m_offset),
 		size, divider, isSigned, invalidValues);
-	m_valueHandler(value);
+	(*m_valueHandler)(value);
     }
 }
 
@@ -360,7 +407,7 @@ EmsMessage::parseBool(size_t offset, uint8_t bit,
 {
     if (canAccess(offset, 1)) {
 	EmsValue value(type, subtype, m_data.at(offset - m_offset), bit);
-	m_valueHandler(value);
+	(*m_valueHandler)(value);
     }
 }
 
@@ -393,8 +440,8 @@ EmsMessage::parseUBA2MaintenanceSettingsMessage()
     parseInteger(1, 1, EmsValue::HektoStundenVorWartung, EmsValue::Kessel);
     parseInteger(5, 1, EmsValue::MonateVorWartung, EmsValue::Kessel);
     if (canAccess(2, sizeof(EmsProto::DateRecord))) {
-        EmsProto::DateRecord *record = (EmsProto::DateRecord *) &m_data.at(2 - m_offset);
-        m_valueHandler(EmsValue(EmsValue::Wartungstermin, EmsValue::Kessel, *record));
+        const EmsProto::DateRecord *record = (const EmsProto::DateRecord *) &m_data.at(2 - m_offset);
+        (*m_valueHandler)(EmsValue(EmsValue::Wartungstermin, EmsValue::Kessel, *record));
     }
 }
 
@@ -480,7 +527,7 @@ EmsMessage::parseUI800ErrorMessage()
             std::ostringstream ss;
             ss <<  m_data[5+i*7] <<  m_data[6+i*7] << m_data[7+i*7];
             if ( (m_data[5+i*7] |  m_data[6+i*7] | m_data[7+i*7]) > 0) {
-                m_valueHandler(EmsValue(EmsValue::StoerungsCode, EmsValue::None, ss.str()));
+                (*m_valueHandler)(EmsValue(EmsValue::StoerungsCode, EmsValue::None, ss.str()));
                 errorsfound = true;
             }
         }
@@ -489,15 +536,15 @@ EmsMessage::parseUI800ErrorMessage()
             std::ostringstream ss;
             ss << std::dec << (m_data[8+i*7] << 8 | m_data[9+i*7]);
             if ( (m_data[8+i*7] |  m_data[9+i*7] ) > 0) {
-                m_valueHandler(EmsValue(EmsValue::StoerungsNummer, EmsValue::None, ss.str()));
+                (*m_valueHandler)(EmsValue(EmsValue::StoerungsNummer, EmsValue::None, ss.str()));
                 errorsfound = true;
             }
         }
     }
     
     if (!errorsfound) {
-                m_valueHandler(EmsValue(EmsValue::StoerungsCode, EmsValue::None, "OK" ));
-                m_valueHandler(EmsValue(EmsValue::StoerungsNummer, EmsValue::None, "0" ));
+                (*m_valueHandler)(EmsValue(EmsValue::StoerungsCode, EmsValue::None, "OK" ));
+                (*m_valueHandler)(EmsValue(EmsValue::StoerungsNummer, EmsValue::None, "0" ));
 
     }
     
@@ -525,15 +572,15 @@ EmsMessage::parseUBA2MonitorMessage()
     if (canAccess(4, 2)) {
 	std::ostringstream ss;
 	ss << std::dec << (m_data[4] << 8 | m_data[5]);
-	m_valueHandler(EmsValue(EmsValue::FehlerCode, EmsValue::None, ss.str()));
-        m_valueHandler(EmsValue(EmsValue::ServiceCode, EmsValue::None, "--"));
+	(*m_valueHandler)(EmsValue(EmsValue::FehlerCode, EmsValue::None, ss.str()));
+        (*m_valueHandler)(EmsValue(EmsValue::ServiceCode, EmsValue::None, "--"));
 	
     }
 
     if (canAccess(19, 2)) {
 	int bakt = ( (m_data[19] << 8 | m_data[20]) > 5 );
 //
-        m_valueHandler(EmsValue(EmsValue::FlammeAktiv, EmsValue::None, bakt, 0 ));
+        (*m_valueHandler)(EmsValue(EmsValue::FlammeAktiv, EmsValue::None, bakt, 0 ));
 	
     }
 }
@@ -585,8 +632,8 @@ void
 EmsMessage::parseRCTimeMessage()
 {
     if (canAccess(0, sizeof(EmsProto::SystemTimeRecord))) {
-	EmsProto::SystemTimeRecord *record = (EmsProto::SystemTimeRecord *) &m_data.at(0);
+	const EmsProto::SystemTimeRecord *record = (const EmsProto::SystemTimeRecord *) &m_data.at(0);
 	EmsValue value(EmsValue::SystemZeit, EmsValue::None, *record);
-	m_valueHandler(value);
+	(*m_valueHandler)(value);
     }
 }
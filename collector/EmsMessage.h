@@ -20,6 +20,7 @@
 #ifndef __EMSMESSAGE_H__
 #define __EMSMESSAGE_H__
 
+#include <stdexcept>
 #include <vector>
 #ifdef HAVE_MQTT // as per its README, mqtt_client_cpp requires its config to be included prior to the boost::variant include
 # include <mqtt/config.hpp>
@@ -237,6 +238,9 @@ class EmsValue {
 	    FehlerCode,
 	    StoerungsCode,
 	    StoerungsNummer,
+
+	    /* not a valid type */
+	    TypeLast
 	};
 
 	enum SubType {
@@ -259,7 +263,10 @@ class EmsValue {
 	    Solar,
 	    SolarPumpe,
 	    SolarSpeicher,
-	    SolarKollektor
+	    SolarKollektor,
+
+	    /* not a valid subtype */
+	    SubTypeLast
 	};
 
 	enum ReadingType {
@@ -302,6 +309,9 @@ class EmsValue {
 	EmsValue(Type type, SubType subType, const EmsProto::DateRecord& date);
 	EmsValue(Type type, SubType subType, const EmsProto::SystemTimeRecord& time);
 	EmsValue(Type type, SubType subType, const std::string& value);
+	/* restores a value previously taken apart with the getters */
+	EmsValue(Type type, SubType subType, ReadingType readingType,
+		 const Reading& value, bool isValid);
 
         Type getType() const {
 	    return m_type;	
@@ -338,9 +348,51 @@ class EmsMessage
 	typedef boost::function<void (const EmsValue& value)> ValueHandler;
 	typedef boost::function<const EmsValue * (EmsValue::Type type, EmsValue::SubType subtype)> CacheAccessor;
 
-	EmsMessage(ValueHandler& valueHandler, CacheAccessor cacheAccesor, const std::vector<uint8_t>& data);
+	/* non-owning view over the payload bytes of a message */
+	class Payload {
+	    public:
+		Payload() :
+		    m_begin(NULL), m_size(0) { }
+		Payload(const uint8_t *begin, size_t size) :
+		    m_begin(begin), m_size(size) { }
+
+		const uint8_t * begin() const {
+		    return m_begin;
+		}
+		const uint8_t * end() const {
+		    return m_begin + m_size;
+		}
+		size_t size() const {
+		    return m_size;
+		}
+		bool empty() const {
+		    return m_size == 0;
+		}
+		const uint8_t& operator[](size_t index) const {
+		    return m_begin[index];
+		}
+		const uint8_t& at(size_t index) const {
+		    if (index >= m_size) {
+			throw std::out_of_range("EmsMessage::Payload");
+		    }
+		    return m_begin[index];
+		}
+
+	    private:
+		const uint8_t *m_begin;
+		size_t m_size;
+	};
+
+	/* Parses a received frame in place. The frame buffer is modified
+	 * while splitting off the header and must outlive the message;
+	 * the handlers are referenced, not copied. Copies of the message
+	 * own their payload and don't depend on the frame buffer. */
+	EmsMessage(const ValueHandler& valueHandler, const CacheAccessor& cacheAccessor,
+		   uint8_t *frame, size_t length);
 	EmsMessage(uint8_t dest, uint16_t type, uint8_t offset,
 		   const std::vector<uint8_t>& data, bool expectResponse);
+	EmsMessage(const EmsMessage& other);
+	EmsMessage& operator=(const EmsMessage& other);
 
 	void handle();
 
@@ -358,7 +410,7 @@ class EmsMessage
 	uint8_t getOffset() const {
 	    return m_offset;
 	}
-	const std::vector<uint8_t>& getData() const {
+	const Payload& getData() const {
 	    return m_data;
 	}
 	std::vector<uint8_t> getSendData(bool omitSenderAddress) const;
@@ -422,9 +474,11 @@ class EmsMessage
 
     private:
 	static const std::vector<const uint8_t *> INVALID_TEMPERATURE_VALUES;
-	ValueHandler m_valueHandler;
-	CacheAccessor m_cacheAccessor;
-	std::vector<unsigned char> m_data;
+	const ValueHandler *m_valueHandler;
+	const CacheAccessor *m_cacheAccessor;
+	/* payload storage of messages we send ourselves and of copies */
+	std::vector<uint8_t> m_ownedData;
+	Payload m_data;
 	uint8_t m_source;
 	uint8_t m_dest;
 	uint8_t m_type;
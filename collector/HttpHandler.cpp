@@ -0,0 +1,375 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <boost/make_shared.hpp>
+#include "HttpHandler.h"
+#include "IoHandler.h"
+#include "Options.h"
+#include "ValueApi.h"
+#include "ValueCache.h"
+
+HttpHandler::HttpHandler(IoHandler& ios, ValueCache *cache,
+			 boost::asio::ip::tcp::endpoint& endpoint) :
+    m_ios(ios),
+    m_acceptor(ios, endpoint),
+    m_cache(cache)
+{
+    startAccepting();
+}
+
+HttpHandler::~HttpHandler()
+{
+    m_acceptor.close();
+    std::for_each(m_connections.begin(), m_connections.end(),
+		  boost::bind(&HttpConnection::close, boost::placeholders::_1));
+    m_connections.clear();
+}
+
+void
+HttpHandler::handleAccept(HttpConnection::Ptr connection,
+			  const boost::system::error_code& error)
+{
+    if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    std::cerr << "Accept error: " << error.message() << std::endl;
+	}
+	return;
+    }
+
+    startConnection(connection);
+    startAccepting();
+}
+
+void
+HttpHandler::startConnection(HttpConnection::Ptr connection)
+{
+    m_connections.insert(connection);
+    connection->start();
+}
+
+void
+HttpHandler::stopConnection(HttpConnection::Ptr connection)
+{
+    m_connections.erase(connection);
+    connection->close();
+}
+
+void
+HttpHandler::handleValue(const EmsValue& value)
+{
+    HttpConnection::Buffer buffer;
+
+    /* advance before sending, a slow client may be disconnected by send() */
+    for (auto iter = m_connections.begin(); iter != m_connections.end(); ) {
+	HttpConnection::Ptr connection = *iter++;
+
+	if (!connection->isStreaming()) {
+	    continue;
+	}
+
+	/* formatted once, shared by all event streams */
+	if (!buffer) {
+	    std::ostringstream stream;
+	    stream << "event: value\ndata: ";
+	    if (!appendJson(stream, value, time(NULL))) {
+		return;
+	    }
+	    stream << "\n\n";
+	    buffer = boost::make_shared<const std::string>(stream.str());
+	}
+
+	connection->send(buffer);
+    }
+}
+
+std::string
+HttpHandler::getValues(const std::vector<std::string>& selector)
+{
+    std::ostringstream stream;
+    bool first = true;
+
+    stream << "[";
+    for (size_t type = 0; m_cache && type < EmsValue::TypeLast; type++) {
+	for (size_t subtype = 0; subtype < EmsValue::SubTypeLast; subtype++) {
+	    ValueCache::EntryPtr entry = m_cache->getEntry((EmsValue::Type) type,
+							   (EmsValue::SubType) subtype);
+	    if (!entry) {
+		continue;
+	    }
+
+	    std::string typeName = ValueApi::getTypeName(entry->value.getType());
+	    std::string subtypeName = ValueApi::getSubTypeName(entry->value.getSubType());
+	    if (typeName.empty() ||
+		    !ValueCache::matchesSelector(selector, typeName, subtypeName)) {
+		continue;
+	    }
+
+	    if (!first) {
+		stream << ",";
+	    }
+	    stream << "\n";
+	    appendJson(stream, entry->value, entry->timestamp);
+	    first = false;
+	}
+    }
+    stream << "\n]\n";
+
+    return stream.str();
+}
+
+static void
+appendCounter(std::ostream& stream, const char *name, const char *help, uint64_t value)
+{
+    stream << "# TYPE " << name << " counter\n";
+    stream << "# HELP " << name << " " << help << "\n";
+    stream << name << "_total " << value << "\n";
+}
+
+std::string
+HttpHandler::getMetrics()
+{
+    const IoHandler::Statistics& stats = m_ios.statistics();
+    std::ostringstream stream;
+
+    if (m_cache) {
+	m_cache->outputMetrics(stream);
+    }
+    appendCounter(stream, "ems_bus_bytes", "Bytes read from the bus", stats.bytesRead);
+    appendCounter(stream, "ems_bus_frames", "Frames received with valid checksum",
+		  stats.framesReceived);
+    appendCounter(stream, "ems_bus_checksum_errors", "Frames dropped due to checksum mismatch",
+		  stats.checksumErrors);
+    appendCounter(stream, "ems_values", "Values decoded from received frames",
+		  stats.valuesDecoded);
+    stream << "# EOF\n";
+
+    return stream.str();
+}
+
+bool
+HttpHandler::appendJson(std::ostream& stream, const EmsValue& value, time_t timestamp)
+{
+    std::string type = ValueApi::getTypeName(value.getType());
+    std::string subtype = ValueApi::getSubTypeName(value.getSubType());
+
+    if (type.empty()) {
+	return false;
+    }
+
+    stream << "{";
+    if (!subtype.empty()) {
+	stream << "\"subtype\":";
+	stream << ValueApi::formatJsonString(subtype);
+	stream << ",";
+    }
+    stream << "\"type\":";
+    stream << ValueApi::formatJsonString(type);
+    stream << ",\"value\":" << ValueApi::formatJsonValue(value);
+    stream << ",\"timestamp\":" << timestamp << "}";
+    return true;
+}
+
+void
+HttpHandler::startAccepting()
+{
+    HttpConnection::Ptr connection(new HttpConnection(m_ios, *this));
+    m_acceptor.async_accept(connection->socket(),
+		            boost::bind(&HttpHandler::handleAccept, this,
+					connection, boost::asio::placeholders::error));
+}
+
+
+HttpConnection::HttpConnection(boost::asio::io_service& ios, HttpHandler& handler) :
+    m_socket(ios),
+    m_handler(handler),
+    m_request(MaxRequestSize),
+    m_streaming(false),
+    m_closeAfterWrite(false)
+{
+}
+
+HttpConnection::~HttpConnection()
+{
+}
+
+void
+HttpConnection::start()
+{
+    boost::asio::async_read_until(m_socket, m_request, "\r\n\r\n",
+	boost::bind(&HttpConnection::handleRequest, shared_from_this(),
+		    boost::asio::placeholders::error));
+}
+
+void
+HttpConnection::handleRequest(const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::not_found) {
+	/* the buffer filled up before the end of the headers */
+	respond("431 Request Header Fields Too Large", "text/plain",
+		"Request header fields too large\n");
+	return;
+    } else if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    m_handler.stopConnection(shared_from_this());
+	}
+	return;
+    }
+
+    /* only the request line matters, headers are ignored */
+    std::istream requestStream(&m_request);
+    std::string method, target;
+    requestStream >> method >> target;
+    m_request.consume(m_request.size());
+
+    size_t query = target.find('?');
+    if (query != std::string::npos) {
+	target.erase(query);
+    }
+
+    std::vector<std::string> path;
+    size_t pos = 0;
+    while (pos < target.size()) {
+	size_t end = target.find('/', pos);
+	if (end == std::string::npos) {
+	    end = target.size();
+	}
+	if (end > pos) {
+	    path.push_back(target.substr(pos, end - pos));
+	}
+	pos = end + 1;
+    }
+
+    if (method != "GET") {
+	respond("405 Method Not Allowed", "text/plain", "Method not allowed\n");
+    } else if (!path.empty() && path[0] == "values" && path.size() <= 3) {
+	std::vector<std::string> selector(path.begin() + 1, path.end());
+	respond("200 OK", "application/json", m_handler.getValues(selector));
+    } else if (path.size() == 1 && path[0] == "metrics") {
+	respond("200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8",
+		m_handler.getMetrics());
+    } else if (path.size() == 1 && path[0] == "events") {
+	std::string header =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Connection: close\r\n"
+		"\r\n";
+	m_streaming = true;
+	send(boost::make_shared<const std::string>(header));
+	/* nothing more is expected from the client, but reading
+	 * notices when it went away */
+	m_socket.async_read_some(m_request.prepare(512),
+	    boost::bind(&HttpConnection::handleStreamRead, shared_from_this(),
+			boost::asio::placeholders::error));
+    } else {
+	respond("404 Not Found", "text/plain", "Not found\n");
+    }
+}
+
+void
+HttpConnection::handleStreamRead(const boost::system::error_code& error)
+{
+    if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    m_handler.stopConnection(shared_from_this());
+	}
+	return;
+    }
+
+    m_socket.async_read_some(m_request.prepare(512),
+	boost::bind(&HttpConnection::handleStreamRead, shared_from_this(),
+		    boost::asio::placeholders::error));
+}
+
+void
+HttpConnection::respond(const std::string& status, const std::string& contentType,
+			const std::string& body)
+{
+    std::ostringstream response;
+
+    response << "HTTP/1.1 " << status << "\r\n";
+    response << "Content-Type: " << contentType << "\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Access-Control-Allow-Origin: *\r\n";
+    response << "Connection: close\r\n\r\n";
+    response << body;
+
+    m_closeAfterWrite = true;
+    send(boost::make_shared<const std::string>(response.str()));
+}
+
+void
+HttpConnection::send(const Buffer& buffer)
+{
+    /* the queue limit and slow client policy are shared with the data port */
+    if (!m_queue.empty() && m_queue.size() >= Options::dataQueueSize()) {
+	if (Options::slowDataClientPolicy() == Options::DisconnectSlowClient) {
+	    if (Options::statsDebug()) {
+		Options::statsDebug() << "HTTP: disconnecting slow client" << std::endl;
+	    }
+	    m_handler.stopConnection(shared_from_this());
+	    return;
+	}
+	m_queue.pop_front();
+    }
+
+    m_queue.push_back(buffer);
+    if (m_writing.empty()) {
+	startWrite();
+    }
+}
+
+void
+HttpConnection::startWrite()
+{
+    std::vector<boost::asio::const_buffer> buffers;
+
+    while (!m_queue.empty() && m_writing.size() < MaxBuffersPerWrite) {
+	m_writing.push_back(m_queue.front());
+	m_queue.pop_front();
+	buffers.push_back(boost::asio::buffer(*m_writing.back()));
+    }
+
+    boost::asio::async_write(m_socket, buffers,
+	boost::bind(&HttpConnection::handleWrite, shared_from_this(),
+		    boost::asio::placeholders::error));
+}
+
+void
+HttpConnection::handleWrite(const boost::system::error_code& error)
+{
+    m_writing.clear();
+
+    if (error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    m_handler.stopConnection(shared_from_this());
+	}
+	return;
+    }
+
+    if (!m_queue.empty()) {
+	startWrite();
+    } else if (m_closeAfterWrite) {
+	boost::system::error_code ignored;
+	m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+	m_handler.stopConnection(shared_from_this());
+    }
+}
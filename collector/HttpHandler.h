@@ -0,0 +1,128 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTPHANDLER_H__
+#define __HTTPHANDLER_H__
+
+#include <deque>
+#include <set>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include "EmsMessage.h"
+#include "Noncopyable.h"
+
+class HttpHandler;
+class IoHandler;
+class ValueCache;
+
+/*
+ * Minimal HTTP/1.1 interface, every response closes the connection:
+ *
+ * GET /values[/<selector>[/<selector>]]
+ *	cached values as JSON array, the selector works like for the
+ *	'cache fetch' command (e.g. /values/hk1/currenttemperature)
+ * GET /events
+ *	live values as server-sent events, one 'value' event per value
+ * GET /metrics
+ *	numeric, integer and boolean values and bus counters in
+ *	OpenMetrics text format
+ *
+ * Values are objects with the members subtype (omitted if none), type,
+ * value (number, boolean, string or null if unavailable) and timestamp
+ * (seconds since epoch).
+ */
+class HttpConnection : public boost::enable_shared_from_this<HttpConnection>,
+		       private boost::noncopyable
+{
+    public:
+	typedef boost::shared_ptr<HttpConnection> Ptr;
+	typedef boost::shared_ptr<const std::string> Buffer;
+
+    public:
+	HttpConnection(boost::asio::io_service& ios, HttpHandler& handler);
+	~HttpConnection();
+
+    public:
+	boost::asio::ip::tcp::socket& socket() {
+	    return m_socket;
+	}
+	void close() {
+	    m_socket.close();
+	}
+	bool isStreaming() const {
+	    return m_streaming;
+	}
+	void start();
+	void send(const Buffer& buffer);
+
+    private:
+	void handleRequest(const boost::system::error_code& error);
+	void handleStreamRead(const boost::system::error_code& error);
+	void respond(const std::string& status, const std::string& contentType,
+		     const std::string& body);
+	void startWrite();
+	void handleWrite(const boost::system::error_code& error);
+
+    private:
+	/* upper limit of buffers gathered into one write */
+	static const size_t MaxBuffersPerWrite = 64;
+	/* request line and headers */
+	static const size_t MaxRequestSize = 8192;
+
+	boost::asio::ip::tcp::socket m_socket;
+	HttpHandler& m_handler;
+	boost::asio::streambuf m_request;
+	std::deque<Buffer> m_queue;
+	/* buffers of the write in progress, kept alive until it finished */
+	std::vector<Buffer> m_writing;
+	bool m_streaming;
+	bool m_closeAfterWrite;
+};
+
+class HttpHandler : private boost::noncopyable
+{
+    public:
+	HttpHandler(IoHandler& ios, ValueCache *cache,
+		    boost::asio::ip::tcp::endpoint& endpoint);
+	~HttpHandler();
+
+    public:
+	void startConnection(HttpConnection::Ptr connection);
+	void stopConnection(HttpConnection::Ptr connection);
+	void handleValue(const EmsValue& value);
+	std::string getValues(const std::vector<std::string>& selector);
+	std::string getMetrics();
+
+    private:
+	static bool appendJson(std::ostream& stream, const EmsValue& value, time_t timestamp);
+	void handleAccept(HttpConnection::Ptr connection,
+			  const boost::system::error_code& error);
+	void startAccepting();
+
+    private:
+	IoHandler& m_ios;
+	boost::asio::ip::tcp::acceptor m_acceptor;
+	std::set<HttpConnection::Ptr> m_connections;
+	ValueCache *m_cache;
+};
+
+#endif /* __HTTPHANDLER_H__ */
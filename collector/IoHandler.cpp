@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <boost/format.hpp>
@@ -28,15 +30,17 @@ IoHandler::IoHandler(ValueCache& cache) :
     boost::asio::io_service(),
     m_active(true),
     m_state(Syncing),
-    m_pos(0)
+    m_pos(0),
+    m_stats()
 {
-    /* pre-alloc buffer to avoid reallocations */
-    m_data.reserve(256);
-
     m_valueCb = boost::bind(&IoHandler::handleValue, this, boost::placeholders::_1);
-    m_cacheCb = [cache] (EmsValue::Type type, EmsValue::SubType subtype) {
+    m_cacheCb = [&cache] (EmsValue::Type type, EmsValue::SubType subtype) {
 	return cache.getValue(type, subtype);
     };
+
+    if (!Options::captureFile().empty()) {
+	m_capture.reset(new BusCaptureWriter(Options::captureFile()));
+    }
 }
 
 void
@@ -61,46 +65,73 @@ IoHandler::readComplete(const boost::system::error_code& error,
 	debug << std::endl;
     }
 
-    while (pos < bytesTransferred) {
-	unsigned char dataByte = m_recvBuffer[pos++];
+    if (m_capture) {
+	m_capture->write(m_recvBuffer, bytesTransferred);
+    }
+
+    m_stats.bytesRead += bytesTransferred;
 
+    while (pos < bytesTransferred) {
 	switch (m_state) {
 	    case Syncing:
-		if (m_pos == 0 && dataByte == 0xaa) {
-		    m_pos = 1;
-		} else if (m_pos == 1 && dataByte == 0x55) {
+		if (m_pos == 0) {
+		    /* skip noise up to the next sync candidate in one go */
+		    const uint8_t *sync = (const uint8_t *) memchr(m_recvBuffer + pos,
+			    0xaa, bytesTransferred - pos);
+		    if (!sync) {
+			pos = bytesTransferred;
+		    } else {
+			pos = sync - m_recvBuffer + 1;
+			m_pos = 1;
+		    }
+		} else if (m_recvBuffer[pos++] == 0x55) {
 		    m_state = Length;
 		    m_pos = 0;
 		} else {
 		    m_pos = 0;
 		}
 		break;
-	    case Length:
-		m_state = Data;
+	    case Length: {
+		uint8_t dataByte = m_recvBuffer[pos++];
+		/* an empty frame would never complete, resync instead */
+		m_state = dataByte != 0 ? Data : Syncing;
 		m_pos = 0;
 		m_length = dataByte;
 		m_checkSum = 0;
 		break;
-	    case Data:
-		m_data.push_back(dataByte);
-		m_checkSum ^= dataByte;
-		m_pos++;
+	    }
+	    case Data: {
+		size_t count = std::min(m_length - m_pos, bytesTransferred - pos);
+		uint8_t *data = m_recvBuffer + pos;
+
+		pos += count;
+		if (m_pos == 0 && count == m_length && pos < bytesTransferred) {
+		    /* frame and checksum are fully contained in the receive
+		     * buffer, so parse the frame right where it is */
+		    if (calcChecksum(data, count) == m_recvBuffer[pos]) {
+			handleFrame(data, count);
+		    } else {
+			m_stats.checksumErrors++;
+		    }
+		    pos++;
+		    m_state = Syncing;
+		    break;
+		}
+
+		memcpy(m_frame + m_pos, data, count);
+		m_checkSum ^= calcChecksum(data, count);
+		m_pos += count;
 		if (m_pos == m_length) {
 		    m_state = Checksum;
 		}
 		break;
+	    }
 	    case Checksum:
-		if (m_checkSum == dataByte) {
-		    EmsMessage message(m_valueCb, m_cacheCb, m_data);
-		    message.handle();
-
-
-		    if ((message.getDestination() | 0x80) == EmsProto::addressPC) {
-                        
-			onPcMessageReceived(message);
-		    }
+		if (m_checkSum == m_recvBuffer[pos++]) {
+		    handleFrame(m_frame, m_length);
+		} else {
+		    m_stats.checksumErrors++;
 		}
-		m_data.clear();
 		m_state = Syncing;
 		m_pos = 0;
 		break;
@@ -110,6 +141,45 @@ IoHandler::readComplete(const boost::system::error_code& error,
     readStart();
 }
 
+uint8_t
+IoHandler::calcChecksum(const uint8_t *data, size_t length)
+{
+    uint64_t wideSum = 0;
+    uint8_t checkSum = 0;
+    size_t i = 0;
+
+    /* XOR is bytewise, so fold 8 bytes per step and combine them at the end */
+    for (; i + sizeof(wideSum) <= length; i += sizeof(wideSum)) {
+	uint64_t chunk;
+	memcpy(&chunk, data + i, sizeof(chunk));
+	wideSum ^= chunk;
+    }
+    for (; i < length; i++) {
+	checkSum ^= data[i];
+    }
+    for (size_t shift = 0; shift < 8 * sizeof(wideSum); shift += 8) {
+	checkSum ^= (uint8_t) (wideSum >> shift);
+    }
+
+    return checkSum;
+}
+
+void
+IoHandler::handleFrame(uint8_t *frame, size_t length)
+{
+    EmsMessage message(m_valueCb, m_cacheCb, frame, length);
+
+    m_stats.framesReceived++;
+    message.handle();
+    for (auto& cb : m_frameCallbacks) {
+	cb(message);
+    }
+
+    if ((message.getDestination() | 0x80) == EmsProto::addressPC) {
+	onPcMessageReceived(message);
+    }
+}
+
 void
 IoHandler::doClose(const boost::system::error_code& error)
 {
@@ -566,6 +636,7 @@ printDescriptive(std::ostream& stream, const EmsValue& value)
 void
 IoHandler::handleValue(const EmsValue& value)
 {
+    m_stats.valuesDecoded++;
     if (Options::dataDebug()) {
 	Options::dataDebug() << "DATA: ";
 	printDescriptive(Options::dataDebug(), value);
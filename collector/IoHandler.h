@@ -24,6 +24,8 @@
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "BusCapture.h"
 #include "EmsMessage.h"
 #include "ValueCache.h"
 
@@ -31,6 +33,16 @@ class IoHandler : public boost::asio::io_service
 {
     public:
 	typedef std::function<void (const EmsValue& value)> ValueCallback;
+	/* called after all values of a frame were passed to the value callbacks */
+	typedef std::function<void (const EmsMessage& message)> FrameCallback;
+
+	/* io thread only */
+	struct Statistics {
+	    uint64_t bytesRead;
+	    uint64_t framesReceived;
+	    uint64_t checksumErrors;
+	    uint64_t valuesDecoded;
+	};
 
     public:
 	IoHandler(ValueCache& cache);
@@ -47,6 +59,13 @@ class IoHandler : public boost::asio::io_service
 	void addValueCallback(ValueCallback& cb) {
 	    m_valueCallbacks.push_back(cb);
 	}
+	void addFrameCallback(FrameCallback& cb) {
+	    m_frameCallbacks.push_back(cb);
+	}
+
+	const Statistics& statistics() const {
+	    return m_stats;
+	}
 
     protected:
 	/* maximum amount of data to read in one operation */
@@ -63,6 +82,10 @@ class IoHandler : public boost::asio::io_service
 	bool m_active;
 	unsigned char m_recvBuffer[maxReadLength];
 
+    private:
+	static uint8_t calcChecksum(const uint8_t *data, size_t length);
+	void handleFrame(uint8_t *frame, size_t length);
+
     private:
 	typedef enum {
 	    Syncing,
@@ -74,10 +97,14 @@ class IoHandler : public boost::asio::io_service
 	State m_state;
 	size_t m_pos, m_length;
 	uint8_t m_checkSum;
-	std::vector<uint8_t> m_data;
+	/* the length byte limits frames to 255 bytes */
+	uint8_t m_frame[256];
 	std::list<ValueCallback> m_valueCallbacks;
+	std::list<FrameCallback> m_frameCallbacks;
 	EmsMessage::ValueHandler m_valueCb;
 	EmsMessage::CacheAccessor m_cacheCb;
+	boost::scoped_ptr<BusCaptureWriter> m_capture;
+	Statistics m_stats;
 };
 
 #endif /* __IOHANDLER_H__ */
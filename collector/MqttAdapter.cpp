@@ -18,6 +18,7 @@
  */
 
 #include <algorithm>
+#include <iomanip>
 #include <boost/bind/bind.hpp>
 #include "MqttAdapter.h"
 #include "Options.h"
@@ -33,43 +34,331 @@ MqttAdapter::MqttAdapter(boost::asio::io_service& ios,
     m_connected(false),
     m_retryDelay(MinRetryDelaySeconds),
     m_retryTimer(ios),
-    m_topicPrefix(topicPrefix.empty() ? "/ems" : topicPrefix)
+    m_topicPrefix(topicPrefix.empty() ? "/ems" : topicPrefix),
+    m_drainTimer(ios),
+    m_draining(false),
+    m_topicAliasMaximum(0),
+    m_nextAlias(1)
 {
+    buildTopics();
+
     m_client->set_client_id("ems-collector");
     m_client->set_error_handler(boost::bind(&MqttAdapter::onError, this, boost::placeholders::_1));
-    m_client->set_connack_handler(boost::bind(&MqttAdapter::onConnect, this,
-					      boost::placeholders::_1, boost::placeholders::_2));
     m_client->set_close_handler(boost::bind(&MqttAdapter::onClose, this));
-    m_client->set_publish_handler(boost::bind(&MqttAdapter::onMessageReceived, this,
-					      boost::placeholders::_3, boost::placeholders::_4));
+    if (Options::mqttV5()) {
+	m_client->set_protocol_version(mqtt::protocol_version::v5);
+	m_client->set_v5_connack_handler(boost::bind(&MqttAdapter::onV5Connect, this,
+						     boost::placeholders::_1, boost::placeholders::_2,
+						     boost::placeholders::_3));
+	m_client->set_v5_publish_handler(boost::bind(&MqttAdapter::onMessageReceived, this,
+						     boost::placeholders::_3, boost::placeholders::_4));
+    } else {
+	m_client->set_connack_handler(boost::bind(&MqttAdapter::onConnect, this,
+						  boost::placeholders::_1, boost::placeholders::_2));
+	m_client->set_publish_handler(boost::bind(&MqttAdapter::onMessageReceived, this,
+						  boost::placeholders::_3, boost::placeholders::_4));
+    }
     m_client->connect();
 }
 
 void
 MqttAdapter::handleValue(const EmsValue& value)
 {
-    if (!m_connected) {
+    if (!m_connected && Options::mqttSpoolSize() == 0) {
 	return;
     }
 
-    std::string type = ValueApi::getTypeName(value.getType());
-    std::string subtype = ValueApi::getSubTypeName(value.getSubType());
+    size_t key = value.getType() * EmsValue::SubTypeLast + value.getSubType();
+    PublishState& state = m_publishStates[key];
+    std::string formattedValue;
+
+    if (Options::mqttAggregate()) {
+	/* kept as JSON value for the device document */
+	formattedValue = ValueApi::formatJsonValue(value);
+    } else if (Options::mqttPayloadFormat() == Options::MqttBinaryPayload) {
+	formattedValue = ValueApi::formatRawValue(value);
+    } else {
+	formattedValue = ValueApi::formatValue(value);
+    }
 
-    std::string topic = m_topicPrefix + "/sensor/";
-    if (!subtype.empty()) {
-	topic += subtype + "/";
+    if (!shouldPublish(state, value, formattedValue)) {
+	return;
     }
-    if (!type.empty()) {
-	topic += type + "/";
+
+    if (Options::mqttAggregate()) {
+	/* the value is kept in its state until the frame is complete */
+	m_frameKeys.push_back(key);
+	return;
+    }
+
+    submit(key, formattedValue);
+}
+
+void
+MqttAdapter::handleFrame(const EmsMessage& message)
+{
+    if (m_frameKeys.empty()) {
+	return;
     }
-    topic += "value";
 
-    std::string formattedValue = ValueApi::formatValue(value);
+    std::vector<size_t> keys;
+    keys.swap(m_frameKeys);
+    submit(DeviceKeyBase + message.getSource(), buildDocument(keys), keys);
+}
+
+std::string
+MqttAdapter::buildDocument(const std::vector<size_t>& valueKeys)
+{
+    std::string members;
+
+    for (size_t key : valueKeys) {
+	const PublishState& state = m_publishStates[key];
+	/* skip values dropped from the spool in the meantime */
+	if (state.evicted) {
+	    continue;
+	}
+
+	EmsValue::Type type = (EmsValue::Type) (key / EmsValue::SubTypeLast);
+	EmsValue::SubType subType = (EmsValue::SubType) (key % EmsValue::SubTypeLast);
+	std::string name = ValueApi::getSubTypeName(subType);
+	if (!name.empty()) {
+	    name += "/";
+	}
+	name += ValueApi::getTypeName(type);
+
+	if (!members.empty()) {
+	    members += ",";
+	}
+	members += ValueApi::formatJsonString(name) + ":" + state.lastPayload;
+    }
+
+    return "{" + members + "}";
+}
+
+void
+MqttAdapter::submit(size_t key, const std::string& payload,
+		    const std::vector<size_t>& valueKeys)
+{
+    /* don't overtake values still waiting in the spool */
+    if (!m_connected || !m_spool.empty()) {
+	spool(key, payload, valueKeys);
+    } else {
+	publish(m_publishStates[key], payload);
+    }
+}
+
+void
+MqttAdapter::publish(PublishState& state, const std::string& payload)
+{
     DebugStream& debug = Options::ioDebug();
     if (debug) {
-	debug << "MQTT: publishing topic '" << topic << "' with value " << formattedValue << std::endl;
+	debug << "MQTT: publishing topic '" << state.topic << "' with ";
+	if (Options::mqttPayloadFormat() == Options::MqttBinaryPayload) {
+	    debug << std::dec << payload.size() << " bytes" << std::endl;
+	} else {
+	    debug << "value " << payload << std::endl;
+	}
+    }
+
+    if (!Options::mqttV5()) {
+	m_client->publish(state.topic, payload, mqtt::qos::at_most_once);
+    } else if (state.alias != 0) {
+	/* the broker maps the alias back to the topic */
+	m_client->publish(std::string(), payload, mqtt::qos::at_most_once,
+			  mqtt::v5::properties { mqtt::v5::property::topic_alias(state.alias) });
+    } else if (m_nextAlias <= m_topicAliasMaximum) {
+	/* the first publish with an alias registers it for this connection */
+	state.alias = m_nextAlias++;
+	m_client->publish(state.topic, payload, mqtt::qos::at_most_once,
+			  mqtt::v5::properties { mqtt::v5::property::topic_alias(state.alias) });
+    } else {
+	m_client->publish(state.topic, payload, mqtt::qos::at_most_once);
+    }
+}
+
+void
+MqttAdapter::spool(size_t key, const std::string& payload,
+		   const std::vector<size_t>& valueKeys)
+{
+    if (Options::mqttSpoolCollapse()) {
+	PublishState& state = m_publishStates[key];
+	if (valueKeys.empty()) {
+	    state.spooledPayload = payload;
+	} else {
+	    /* merge the members of a device document, the values are
+	     * taken from their states when the document is drained */
+	    for (size_t valueKey : valueKeys) {
+		if (std::find(state.spooledKeys.begin(), state.spooledKeys.end(),
+			      valueKey) == state.spooledKeys.end()) {
+		    state.spooledKeys.push_back(valueKey);
+		}
+	    }
+	}
+	if (state.spooled) {
+	    return;
+	}
+	state.spooled = true;
+    }
+
+    if (m_spool.size() >= Options::mqttSpoolSize()) {
+	const SpoolEntry& front = m_spool.front();
+	PublishState& evicted = m_publishStates[front.key];
+	std::vector<size_t> keys = Options::mqttSpoolCollapse()
+		? evicted.spooledKeys : front.valueKeys;
+
+	/* the evicted values never reached the broker, so the next ones
+	 * received for those keys must go out regardless of deadband */
+	keys.push_back(front.key);
+	for (size_t evictedKey : keys) {
+	    PublishState& state = m_publishStates[evictedKey];
+	    state.spooled = false;
+	    state.published = false;
+	    state.evicted = true;
+	    state.lastPayload.clear();
+	}
+	evicted.spooledKeys.clear();
+	m_spool.pop_front();
+    }
+
+    SpoolEntry entry;
+    entry.key = key;
+    if (!Options::mqttSpoolCollapse()) {
+	entry.payload = payload;
+	entry.valueKeys = valueKeys;
+    }
+    m_spool.push_back(entry);
+}
+
+void
+MqttAdapter::scheduleDrain()
+{
+    if (m_draining || m_spool.empty()) {
+	return;
+    }
+
+    m_draining = true;
+    m_drainTimer.expires_from_now(boost::posix_time::milliseconds(DrainIntervalMs));
+    m_drainTimer.async_wait([this] (const boost::system::error_code& error) {
+	m_draining = false;
+	if (error != boost::asio::error::operation_aborted) {
+	    drainSpool();
+	}
+    });
+}
+
+void
+MqttAdapter::drainSpool()
+{
+    /* spread the backlog over time instead of flooding the broker */
+    size_t count = std::max(Options::mqttDrainRate() * DrainIntervalMs / 1000, 1U);
+
+    while (m_connected && count-- > 0 && !m_spool.empty()) {
+	const SpoolEntry& entry = m_spool.front();
+	PublishState& state = m_publishStates[entry.key];
+
+	if (Options::mqttSpoolCollapse() && !state.spooledKeys.empty()) {
+	    publish(state, buildDocument(state.spooledKeys));
+	    state.spooledKeys.clear();
+	    state.spooled = false;
+	} else if (Options::mqttSpoolCollapse()) {
+	    publish(state, state.spooledPayload);
+	    state.spooled = false;
+	} else {
+	    publish(state, entry.payload);
+	}
+	m_spool.pop_front();
+    }
+
+    if (m_connected && m_spool.empty()) {
+	Options::ioDebug() << "MQTT: spooled values drained" << std::endl;
+    } else if (m_connected) {
+	scheduleDrain();
+    }
+}
+
+bool
+MqttAdapter::shouldPublish(PublishState& state, const EmsValue& value,
+			   const std::string& payload)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::seconds minInterval(Options::mqttMinInterval());
+    std::chrono::seconds heartbeat(Options::mqttHeartbeat());
+    bool valid = value.isValid();
+    bool numeric = value.getReadingType() == EmsValue::Numeric && valid;
+    bool changed;
+
+    if (!state.published) {
+	changed = true;
+    } else if (valid != state.lastValid) {
+	/* a value becoming (un)available is never within the deadband */
+	changed = true;
+    } else if (numeric && payload != state.lastPayload) {
+	float current = value.getValue<float>();
+	float delta = current > state.lastNumeric
+		? current - state.lastNumeric : state.lastNumeric - current;
+	changed = delta > 0 && delta >= Options::mqttDeadband();
+    } else {
+	changed = payload != state.lastPayload;
+    }
+
+    if (state.published) {
+	bool heartbeatDue = heartbeat.count() != 0 && now - state.lastPublish >= heartbeat;
+	/* a change held back by the minimum interval goes out with the next
+	 * value received after the interval passed */
+	bool intervalPassed = now - state.lastPublish >= minInterval;
+
+	if (!heartbeatDue && !(changed && intervalPassed)) {
+	    return false;
+	}
+    }
+
+    state.lastPayload = payload;
+    state.lastValid = valid;
+    if (numeric) {
+	state.lastNumeric = value.getValue<float>();
+    }
+    state.published = true;
+    state.evicted = false;
+    state.lastPublish = now;
+    return true;
+}
+
+void
+MqttAdapter::buildTopics()
+{
+    m_publishStates.resize(DeviceKeyBase + DeviceKeyCount);
+
+    for (size_t type = 0; type < EmsValue::TypeLast; type++) {
+	std::string typeName = ValueApi::getTypeName((EmsValue::Type) type);
+	for (size_t subtype = 0; subtype < EmsValue::SubTypeLast; subtype++) {
+	    std::string subtypeName = ValueApi::getSubTypeName((EmsValue::SubType) subtype);
+	    PublishState& state = m_publishStates[type * EmsValue::SubTypeLast + subtype];
+
+	    state.topic = m_topicPrefix + "/sensor/";
+	    if (!subtypeName.empty()) {
+		state.topic += subtypeName + "/";
+	    }
+	    if (!typeName.empty()) {
+		state.topic += typeName + "/";
+	    }
+	    state.topic += "value";
+	    state.lastNumeric = 0;
+	    state.lastValid = false;
+	    state.published = false;
+	    state.evicted = false;
+	    state.spooled = false;
+	    state.alias = 0;
+	}
+    }
+
+    for (size_t address = 0; address < DeviceKeyCount; address++) {
+	std::ostringstream topic;
+	topic << m_topicPrefix << "/device/" << std::hex << std::setw(2)
+	      << std::setfill('0') << address;
+	m_publishStates[DeviceKeyBase + address].topic = topic.str();
+	m_publishStates[DeviceKeyBase + address].spooled = false;
+	m_publishStates[DeviceKeyBase + address].alias = 0;
     }
-    m_client->publish(topic, formattedValue, mqtt::qos::at_most_once);
 }
 
 bool
@@ -77,17 +366,57 @@ MqttAdapter::onConnect(bool sessionPresent, mqtt::connect_return_code returnCode
 {
     Options::ioDebug() << "MQTT: onConnect, return code "
 		       << std::dec << (unsigned int) returnCode << std::endl;
-    m_connected = returnCode == mqtt::connect_return_code::accepted;
+    handleConnect(returnCode == mqtt::connect_return_code::accepted);
+    return true;
+}
+
+bool
+MqttAdapter::onV5Connect(bool sessionPresent, mqtt::v5::connect_reason_code reasonCode,
+			 mqtt::v5::properties properties)
+{
+    Options::ioDebug() << "MQTT: onConnect, reason code "
+		       << std::dec << (unsigned int) reasonCode << std::endl;
+
+    /* without the property, the broker doesn't accept any alias */
+    m_topicAliasMaximum = 0;
+    for (const auto& property : properties) {
+	mqtt::visit(mqtt::make_lambda_visitor(
+	    [this] (const mqtt::v5::property::topic_alias_maximum& maximum) {
+		m_topicAliasMaximum = maximum.val();
+	    },
+	    [] (const auto&) { }), property);
+    }
+
+    handleConnect(reasonCode == mqtt::v5::connect_reason_code::success);
+    return true;
+}
+
+void
+MqttAdapter::handleConnect(bool accepted)
+{
+    m_connected = accepted;
     if (!m_connected) {
 	m_retryDelay = MinRetryDelaySeconds;
 	scheduleConnectionRetry();
-    } else if (m_sender) {
+	return;
+    }
+
+    /* the broker doesn't retain our values, so republish
+     * everything after (re)connecting; topic aliases are
+     * only valid for one connection */
+    for (auto& state : m_publishStates) {
+	state.published = false;
+	state.alias = 0;
+    }
+    m_nextAlias = 1;
+    scheduleDrain();
+
+    if (m_sender) {
 	m_client->subscribe(m_topicPrefix + "/control/#", mqtt::qos::exactly_once);
 	auto outputCb = [] (const std::string&) {};
 	m_commandParser.reset(
 		new ApiCommandParser(*m_sender, m_cmdClient, nullptr, outputCb));
     }
-    return true;
 }
 
 void
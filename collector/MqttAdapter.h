@@ -25,6 +25,9 @@
 
 #ifdef HAVE_MQTT
 
+#include <chrono>
+#include <deque>
+#include <vector>
 #include <mqtt_client_cpp.hpp>
 #include "ApiCommandParser.h"
 #include "Noncopyable.h"
@@ -38,15 +41,61 @@ class MqttAdapter : public boost::noncopyable
 		    const std::string& topicPrefix);
 
 	void handleValue(const EmsValue& value);
+	void handleFrame(const EmsMessage& message);
 
     private:
 	bool onConnect(bool sessionPresent, mqtt::connect_return_code returnCode);
+	bool onV5Connect(bool sessionPresent, mqtt::v5::connect_reason_code reasonCode,
+			 mqtt::v5::properties properties);
+	void handleConnect(bool accepted);
 	void onError(const mqtt::error_code& ec);
 	void onClose();
 	bool onMessageReceived(const mqtt::buffer& topic, const mqtt::buffer& contents);
 	void scheduleConnectionRetry();
 
     private:
+	/* per value key, indexed by type * number of subtypes + subtype */
+	struct PublishState {
+	    std::string topic;
+	    std::string lastPayload;
+	    /* only meaningful if the last published value was valid */
+	    float lastNumeric;
+	    bool lastValid;
+	    bool published;
+	    /* the last value was dropped from the full spool, unlike
+	     * published this isn't reset when reconnecting */
+	    bool evicted;
+	    std::chrono::steady_clock::time_point lastPublish;
+	    /* collapsed spool mode: the payload of the pending entry, or
+	     * the value keys of a pending device document */
+	    bool spooled;
+	    std::string spooledPayload;
+	    std::vector<size_t> spooledKeys;
+	    /* MQTT 5 topic alias on the current connection, 0 if none */
+	    uint16_t alias;
+	};
+
+	/* values held back while the broker is unreachable or
+	 * older values are still being drained */
+	struct SpoolEntry {
+	    size_t key;
+	    std::string payload;
+	    /* device documents: the value keys the document was built from */
+	    std::vector<size_t> valueKeys;
+	};
+
+	void buildTopics();
+	bool shouldPublish(PublishState& state, const EmsValue& value,
+			   const std::string& payload);
+	std::string buildDocument(const std::vector<size_t>& valueKeys);
+	void submit(size_t key, const std::string& payload,
+		    const std::vector<size_t>& valueKeys = std::vector<size_t>());
+	void publish(PublishState& state, const std::string& payload);
+	void spool(size_t key, const std::string& payload,
+		   const std::vector<size_t>& valueKeys);
+	void scheduleDrain();
+	void drainSpool();
+
 	class CommandClient : public EmsCommandClient {
 	    public:
 		CommandClient(MqttAdapter *adapter) :
@@ -66,6 +115,10 @@ class MqttAdapter : public boost::noncopyable
     private:
 	static const unsigned int MinRetryDelaySeconds = 5;
 	static const unsigned int MaxRetryDelaySeconds = 5 * 60;
+	static const unsigned int DrainIntervalMs = 100;
+	/* value keys are followed by one key per bus address for aggregated documents */
+	static const size_t DeviceKeyBase = EmsValue::TypeLast * EmsValue::SubTypeLast;
+	static const size_t DeviceKeyCount = 256;
 
 	std::shared_ptr<mqtt::callable_overlay<mqtt::client<
 		mqtt::tcp_endpoint<boost::asio::ip::tcp::socket, boost::asio::io_service::strand> > > > m_client;
@@ -76,6 +129,14 @@ class MqttAdapter : public boost::noncopyable
 	std::unique_ptr<ApiCommandParser> m_commandParser;
 	boost::asio::deadline_timer m_retryTimer;
 	std::string m_topicPrefix;
+	std::vector<PublishState> m_publishStates;
+	/* value keys of the frame currently being handled */
+	std::vector<size_t> m_frameKeys;
+	std::deque<SpoolEntry> m_spool;
+	boost::asio::deadline_timer m_drainTimer;
+	bool m_draining;
+	uint16_t m_topicAliasMaximum;
+	uint16_t m_nextAlias;
 };
 
 #else /* HAVE_MQTT */
@@ -89,6 +150,7 @@ class MqttAdapter {
 	{}
 
 	void handleValue(const EmsValue& /* value */) {}
+	void handleFrame(const EmsMessage& /* message */) {}
 };
 
 #endif /* !HAVE_MQTT */
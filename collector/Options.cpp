@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sstream>
 #include <boost/foreach.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/program_options.hpp>
@@ -27,7 +28,19 @@ namespace bpo = boost::program_options;
 std::string Options::m_target;
 std::string Options::m_mqttTarget;
 std::string Options::m_mqttPrefix;
+float Options::m_mqttDeadband = 0;
+unsigned int Options::m_mqttMinInterval = 0;
+unsigned int Options::m_mqttHeartbeat = 0;
+unsigned int Options::m_mqttSpoolSize = 10000;
+bool Options::m_mqttSpoolCollapse = false;
+unsigned int Options::m_mqttDrainRate = 100;
+bool Options::m_mqttAggregate = false;
+bool Options::m_mqttV5 = false;
+Options::MqttPayloadFormat Options::m_mqttPayloadFormat = Options::MqttTextPayload;
 unsigned int Options::m_rateLimit = 0;
+std::string Options::m_captureFile;
+std::string Options::m_cacheFile;
+unsigned int Options::m_cacheHistorySize = 360;
 DebugStream Options::m_debugStreams[DebugCount];
 std::string Options::m_pidFilePath;
 bool Options::m_daemonize = true;
@@ -35,8 +48,17 @@ std::string Options::m_dbPath;
 std::string Options::m_dbUser;
 std::string Options::m_dbPass;
 std::string Options::m_dbName;
+unsigned int Options::m_dbFlushInterval = 5;
+unsigned int Options::m_dbCheckpointInterval = 30;
+unsigned int Options::m_dbQueueSize = 10000;
 unsigned int Options::m_commandPort = 0;
 unsigned int Options::m_dataPort = 0;
+unsigned int Options::m_dataQueueSize = 1000;
+unsigned int Options::m_httpPort = 0;
+bool Options::m_pollEnabled = false;
+unsigned int Options::m_pollBudget = 5;
+std::vector<Options::PollInterval> Options::m_pollIntervals;
+Options::SlowClientPolicy Options::m_slowDataClientPolicy = Options::DropOldestValues;
 Options::RoomControllerType Options::m_rcType = Options::RCUnknown;
 
 static void
@@ -48,6 +70,8 @@ usage(std::ostream& stream, const char *programName,
     stream << "  serial:<device>     Connect to serial device <device> without sending support (e.g. Atmega8)" << std::endl;
     stream << "  tx-serial:<device>  Connect to serial device <device> with sending support (e.g. EMS Gateway)" << std::endl;
     stream << "  tcp:<host>:<port>   Connect to TCP address <host> at <port> (e.g. NetIO)" << std::endl;
+    stream << "  replay:<file>[,speed=max|1x|10x]" << std::endl;
+    stream << "                      Replay a capture recorded with --capture-file (default speed 1x)" << std::endl;
     stream << options << std::endl;
 }
 
@@ -55,7 +79,8 @@ Options::ParseResult
 Options::parse(int argc, char *argv[])
 {
     std::string defaultPidFilePath;
-    std::string config, rcType;
+    std::string config, rcType, slowClientPolicy, mqttPayload;
+    std::vector<std::string> pollIntervals;
 
     defaultPidFilePath = "/var/run/";
     defaultPidFilePath += argv[0];
@@ -68,6 +93,12 @@ Options::parse(int argc, char *argv[])
 	 "Type of used room controller (rc30 or rc35)")
 	("ratelimit,r", bpo::value<unsigned int>(&m_rateLimit)->default_value(60),
 	 "Rate limit (in s) for writing numeric sensor values into DB")
+	("capture-file", bpo::value<std::string>(&m_captureFile)->composing(),
+	 "File to record all raw bus data into, for later use with the replay target")
+	("cache-file", bpo::value<std::string>(&m_cacheFile)->composing(),
+	 "File to keep the value cache in, so that it survives restarts")
+	("cache-history", bpo::value<unsigned int>(&m_cacheHistorySize)->default_value(360),
+	 "Number of past values kept per cache entry for 'cache history' (0 to disable)")
 	("debug,d", bpo::value<std::string>()->default_value("none"),
 	 "Comma separated list of debug flags (all, io, message, data, stats, none) "
 	 " and their files, e.g. message=/tmp/messages.txt");
@@ -93,7 +124,14 @@ Options::parse(int argc, char *argv[])
 	("db-pass,p", bpo::value<std::string>(&m_dbPass)->composing(),
 	 "Database password")
 	("db-name,n", bpo::value<std::string>(&m_dbName)->composing(),
-	 "Database name");
+	 "Database name")
+	("db-flush-interval", bpo::value<unsigned int>(&m_dbFlushInterval)->default_value(5),
+	 "Interval (in s) in which queued sensor values are written into DB")
+	("db-checkpoint-interval", bpo::value<unsigned int>(&m_dbCheckpointInterval)->default_value(30),
+	 "Interval (in s) in which the end time of unchanged sensor values is updated in DB; "
+	 "the webpage shows current values up to that old")
+	("db-queue-size", bpo::value<unsigned int>(&m_dbQueueSize)->default_value(10000),
+	 "Maximum number of sensor values queued for DB writing before dropping values");
 #endif
 
     bpo::options_description tcp("TCP options");
@@ -101,7 +139,23 @@ Options::parse(int argc, char *argv[])
 	("command-port,C", bpo::value<unsigned int>(&m_commandPort)->composing(),
 	 "TCP port for remote command interface (0 to disable)")
 	("data-port,D", bpo::value<unsigned int>(&m_dataPort)->composing(),
-	 "TCP port for broadcasting live sensor data (0 to disable)");
+	 "TCP port for broadcasting live sensor data (0 to disable)")
+	("data-queue-size", bpo::value<unsigned int>(&m_dataQueueSize)->default_value(1000),
+	 "Maximum number of values queued for a data port client")
+	("data-slow-client", bpo::value<std::string>(&slowClientPolicy)->composing(),
+	 "What to do with data port clients whose queue is full (drop-oldest or disconnect)")
+	("http-port", bpo::value<unsigned int>(&m_httpPort)->composing(),
+	 "TCP port for serving cached values as JSON and live values as event stream (0 to disable)");
+
+    bpo::options_description poll("Polling options");
+    poll.add_options()
+	("poll", bpo::bool_switch(&m_pollEnabled),
+	 "Periodically read values that aren't broadcast, after reading all known types once")
+	("poll-budget", bpo::value<unsigned int>(&m_pollBudget)->default_value(5),
+	 "Share (in %) of the bus capacity used for polling")
+	("poll-interval", bpo::value<std::vector<std::string> >(&pollIntervals)->composing(),
+	 "Polling interval (in s) of a type as <address>:<type>[:<length>]=<interval>, "
+	 "e.g. 0x90:0x01af=600 (interval 0 reads it only when connecting)");
 
 #ifdef HAVE_MQTT
     bpo::options_description interface("Interface options");
@@ -109,7 +163,25 @@ Options::parse(int argc, char *argv[])
 	("mqtt-broker", bpo::value<std::string>(&m_mqttTarget)->composing(),
 	 "MQTT broker address (<host>:<port>)")
 	("mqtt-prefix", bpo::value<std::string>(&m_mqttPrefix)->composing(),
-	 "MQTT topic prefix (default: /ems)");
+	 "MQTT topic prefix (default: /ems)")
+	("mqtt-deadband", bpo::value<float>(&m_mqttDeadband)->default_value(0),
+	 "Minimum change of numeric values to be published again (0 publishes any change)")
+	("mqtt-min-interval", bpo::value<unsigned int>(&m_mqttMinInterval)->default_value(0),
+	 "Minimum interval (in s) between publishing changes of the same value")
+	("mqtt-heartbeat", bpo::value<unsigned int>(&m_mqttHeartbeat)->default_value(0),
+	 "Interval (in s) after which unchanged values are published again (0 to disable)")
+	("mqtt-spool-size", bpo::value<unsigned int>(&m_mqttSpoolSize)->default_value(10000),
+	 "Maximum number of values kept while the broker is unreachable (0 to disable)")
+	("mqtt-spool-collapse", bpo::bool_switch(&m_mqttSpoolCollapse),
+	 "Only keep the latest value per topic while the broker is unreachable")
+	("mqtt-drain-rate", bpo::value<unsigned int>(&m_mqttDrainRate)->default_value(100),
+	 "Number of kept values published per second after reconnecting to the broker")
+	("mqtt-aggregate", bpo::bool_switch(&m_mqttAggregate),
+	 "Publish all values of a received frame as one JSON document per device")
+	("mqtt-v5", bpo::bool_switch(&m_mqttV5),
+	 "Use MQTT 5 and replace topics by topic aliases after their first use")
+	("mqtt-payload", bpo::value<std::string>(&mqttPayload)->composing(),
+	 "Payload format of single values (text or binary)");
 #endif
 
     bpo::options_description hidden("Hidden options");
@@ -123,6 +195,7 @@ Options::parse(int argc, char *argv[])
     options.add(db);
 #endif
     options.add(tcp);
+    options.add(poll);
 #ifdef HAVE_MQTT
     options.add(interface);
 #endif
@@ -134,6 +207,7 @@ Options::parse(int argc, char *argv[])
     configOptions.add(db);
 #endif
     configOptions.add(tcp);
+    configOptions.add(poll);
 #ifdef HAVE_MQTT
     configOptions.add(interface);
 #endif
@@ -145,6 +219,7 @@ Options::parse(int argc, char *argv[])
     visible.add(db);
 #endif
     visible.add(tcp);
+    visible.add(poll);
 #ifdef HAVE_MQTT
     visible.add(interface);
 #endif
@@ -194,6 +269,56 @@ Options::parse(int argc, char *argv[])
 	}
     }
 
+    if (variables.count("data-slow-client")) {
+	if (slowClientPolicy == "drop-oldest") {
+	    m_slowDataClientPolicy = Options::DropOldestValues;
+	} else if (slowClientPolicy == "disconnect") {
+	    m_slowDataClientPolicy = Options::DisconnectSlowClient;
+	} else {
+	    usage(std::cerr, argv[0], visible);
+	    return ParseFailure;
+	}
+    }
+
+    if (variables.count("mqtt-payload")) {
+	if (mqttPayload == "text") {
+	    m_mqttPayloadFormat = Options::MqttTextPayload;
+	} else if (mqttPayload == "binary") {
+	    m_mqttPayloadFormat = Options::MqttBinaryPayload;
+	} else {
+	    usage(std::cerr, argv[0], visible);
+	    return ParseFailure;
+	}
+    }
+
+    if (m_pollBudget == 0 || m_pollBudget > 100) {
+	usage(std::cerr, argv[0], visible);
+	return ParseFailure;
+    }
+
+    BOOST_FOREACH(const std::string& item, pollIntervals) {
+	PollInterval interval;
+	unsigned int address, type, length = 0;
+	char sep1, sep2;
+	std::istringstream stream(item);
+
+	stream.unsetf(std::ios_base::basefield);
+	stream >> address >> sep1 >> type >> sep2;
+	if (stream && sep2 == ':') {
+	    stream >> length >> sep2;
+	}
+	stream >> interval.interval;
+	if (!stream || !stream.eof() || sep1 != ':' || sep2 != '=' ||
+		address > 0xff || type > 0xffff || length > 0xff) {
+	    usage(std::cerr, argv[0], visible);
+	    return ParseFailure;
+	}
+	interval.address = address;
+	interval.type = type;
+	interval.length = length;
+	m_pollIntervals.push_back(interval);
+    }
+
     if (variables.count("foreground")) {
 	m_daemonize = false;
     }
@@ -227,6 +352,8 @@ Options::parse(int argc, char *argv[])
 		    module = DebugMessages;
 		} else if (item.compare(0, 4, "data") == 0) {
 		    module = DebugData;
+		} else if (item.compare(0, 5, "stats") == 0) {
+		    module = DebugStats;
 		} else {
 		    continue;
 		}
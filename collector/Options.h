@@ -20,8 +20,10 @@
 #ifndef __OPTIONS_H__
 #define __OPTIONS_H__
 
+#include <stdint.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 class DebugStream : public std::ostream
 {
@@ -66,6 +68,25 @@ class Options
 	    CloseAfterParse
 	} ParseResult;
 
+	typedef enum {
+	    MqttTextPayload,
+	    MqttBinaryPayload
+	} MqttPayloadFormat;
+
+	typedef enum {
+	    DropOldestValues,
+	    DisconnectSlowClient
+	} SlowClientPolicy;
+
+	typedef struct {
+	    uint8_t address;
+	    uint16_t type;
+	    /* 0 to use the length of a known type */
+	    unsigned int length;
+	    /* in s, 0 to only read it when connecting */
+	    unsigned int interval;
+	} PollInterval;
+
 	typedef enum {
 	    RCUnknown,
 	    RC30,
@@ -85,9 +106,45 @@ class Options
 	static const std::string& mqttPrefix() {
 	    return m_mqttPrefix;
 	}
+	static float mqttDeadband() {
+	    return m_mqttDeadband;
+	}
+	static unsigned int mqttMinInterval() {
+	    return m_mqttMinInterval;
+	}
+	static unsigned int mqttHeartbeat() {
+	    return m_mqttHeartbeat;
+	}
+	static unsigned int mqttSpoolSize() {
+	    return m_mqttSpoolSize;
+	}
+	static bool mqttSpoolCollapse() {
+	    return m_mqttSpoolCollapse;
+	}
+	static unsigned int mqttDrainRate() {
+	    return m_mqttDrainRate;
+	}
+	static bool mqttAggregate() {
+	    return m_mqttAggregate;
+	}
+	static bool mqttV5() {
+	    return m_mqttV5;
+	}
+	static MqttPayloadFormat mqttPayloadFormat() {
+	    return m_mqttPayloadFormat;
+	}
 	static bool daemonize() {
 	    return m_daemonize;
 	}
+	static const std::string& captureFile() {
+	    return m_captureFile;
+	}
+	static const std::string& cacheFile() {
+	    return m_cacheFile;
+	}
+	static unsigned int cacheHistorySize() {
+	    return m_cacheHistorySize;
+	}
 	static const std::string& pidFilePath() {
 	    return m_pidFilePath;
 	}
@@ -103,12 +160,39 @@ class Options
 	static const std::string& databaseName() {
 	    return m_dbName;
 	}
+	static unsigned int databaseFlushInterval() {
+	    return m_dbFlushInterval;
+	}
+	static unsigned int databaseCheckpointInterval() {
+	    return m_dbCheckpointInterval;
+	}
+	static unsigned int databaseQueueSize() {
+	    return m_dbQueueSize;
+	}
 	static unsigned int commandPort() {
 	    return m_commandPort;
 	}
 	static unsigned int dataPort() {
 	    return m_dataPort;
 	}
+	static unsigned int dataQueueSize() {
+	    return m_dataQueueSize;
+	}
+	static SlowClientPolicy slowDataClientPolicy() {
+	    return m_slowDataClientPolicy;
+	}
+	static unsigned int httpPort() {
+	    return m_httpPort;
+	}
+	static bool pollEnabled() {
+	    return m_pollEnabled;
+	}
+	static unsigned int pollBudget() {
+	    return m_pollBudget;
+	}
+	static const std::vector<PollInterval>& pollIntervals() {
+	    return m_pollIntervals;
+	}
 
 	static RoomControllerType roomControllerType() {
 	    return m_rcType;
@@ -120,7 +204,8 @@ class Options
 	static const unsigned int DebugIo = 0;
 	static const unsigned int DebugMessages = 1;
 	static const unsigned int DebugData = 2;
-	static const unsigned int DebugCount = 3;
+	static const unsigned int DebugStats = 3;
+	static const unsigned int DebugCount = 4;
 	static DebugStream m_debugStreams[DebugCount];
 
     public:
@@ -133,20 +218,44 @@ class Options
 	static DebugStream& dataDebug() {
 	    return m_debugStreams[DebugData];
 	}
+	static DebugStream& statsDebug() {
+	    return m_debugStreams[DebugStats];
+	}
 
     private:
 	static std::string m_target;
 	static std::string m_mqttTarget;
 	static std::string m_mqttPrefix;
+	static float m_mqttDeadband;
+	static unsigned int m_mqttMinInterval;
+	static unsigned int m_mqttHeartbeat;
+	static unsigned int m_mqttSpoolSize;
+	static bool m_mqttSpoolCollapse;
+	static unsigned int m_mqttDrainRate;
+	static bool m_mqttAggregate;
+	static bool m_mqttV5;
+	static MqttPayloadFormat m_mqttPayloadFormat;
 	static unsigned int m_rateLimit;
+	static std::string m_captureFile;
+	static std::string m_cacheFile;
+	static unsigned int m_cacheHistorySize;
 	static std::string m_pidFilePath;
 	static bool m_daemonize;
 	static std::string m_dbPath;
 	static std::string m_dbUser;
 	static std::string m_dbPass;
 	static std::string m_dbName;
+	static unsigned int m_dbFlushInterval;
+	static unsigned int m_dbCheckpointInterval;
+	static unsigned int m_dbQueueSize;
 	static unsigned int m_commandPort;
 	static unsigned int m_dataPort;
+	static unsigned int m_dataQueueSize;
+	static SlowClientPolicy m_slowDataClientPolicy;
+	static unsigned int m_httpPort;
+	static bool m_pollEnabled;
+	static unsigned int m_pollBudget;
+	static std::vector<PollInterval> m_pollIntervals;
 	static RoomControllerType m_rcType;
 };
 
@@ -0,0 +1,210 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/format.hpp>
+#include "Options.h"
+#include "Poller.h"
+
+static const struct {
+    uint8_t address;
+    uint16_t type;
+    uint8_t length;
+    unsigned int interval;
+} KNOWN_TYPES[] = {
+    { EmsProto::addressUBA2, 0x0015, 10, 3600 },	/* maintenance settings */
+    { EmsProto::addressUBA2, 0x00ea, 25, 3600 },	/* WW parameters */
+    { EmsProto::addressUBA2, 0x00bf, 20, 0 },		/* current error */
+    { EmsProto::addressUI800, 0x00bf, 20, 0 },		/* current error */
+    { EmsProto::addressUI800, 0x0140, 46, 3600 },	/* system parameters */
+    { EmsProto::addressUI800, 0x01b9, 32, 600 },	/* HK1 configuration */
+    { EmsProto::addressUI800, 0x01a5, 46, 0 },		/* HK1 status */
+    { EmsProto::addressUI800, 0x01af, 46, 600 },	/* HK1 parameters */
+    { EmsProto::addressUI800, 0x01f5, 21, 600 },	/* WW configuration */
+};
+
+Poller::Poller(boost::asio::io_service& ios, EmsCommandSender& sender) :
+    m_sender(sender),
+    m_client(new PollClient(this)),
+    m_timer(ios),
+    m_active(NULL),
+    m_received(0)
+{
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time() +
+	    boost::posix_time::seconds(StartDelay);
+
+    for (auto& known : KNOWN_TYPES) {
+	Entry entry = { known.address, known.type, known.length, known.interval, start };
+	m_entries.push_back(entry);
+    }
+
+    for (auto& configured : Options::pollIntervals()) {
+	auto iter = std::find_if(m_entries.begin(), m_entries.end(),
+				 [&configured] (const Entry& entry) {
+	    return (entry.address & 0x7f) == (configured.address & 0x7f) &&
+		    entry.type == configured.type;
+	});
+	if (iter == m_entries.end()) {
+	    Entry entry = { configured.address, configured.type, DefaultLength, 0, start };
+	    iter = m_entries.insert(m_entries.end(), entry);
+	}
+	iter->interval = configured.interval;
+	if (configured.length != 0) {
+	    iter->length = configured.length;
+	}
+    }
+
+    scheduleNext();
+}
+
+Poller::~Poller()
+{
+    m_timer.cancel();
+}
+
+Poller::Entry *
+Poller::nextEntry()
+{
+    Entry *next = NULL;
+
+    for (auto& entry : m_entries) {
+	if (!entry.due.is_special() && (!next || entry.due < next->due)) {
+	    next = &entry;
+	}
+    }
+    return next;
+}
+
+void
+Poller::scheduleNext()
+{
+    boost::posix_time::ptime at;
+
+    if (m_active) {
+	/* next chunk of the entry being read */
+	at = m_nextSend;
+    } else {
+	Entry *next = nextEntry();
+	if (!next) {
+	    return;
+	}
+	at = next->due;
+	if (!m_nextSend.is_not_a_date_time()) {
+	    at = std::max(at, m_nextSend);
+	}
+    }
+
+    m_timer.expires_at(at);
+    m_timer.async_wait(boost::bind(&Poller::handleTimer, this,
+				   boost::asio::placeholders::error));
+}
+
+void
+Poller::handleTimer(const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted) {
+	return;
+    }
+
+    if (m_sender.hasPendingRequests(m_client)) {
+	m_timer.expires_from_now(boost::posix_time::seconds(BusyDelay));
+	m_timer.async_wait(boost::bind(&Poller::handleTimer, this,
+				       boost::asio::placeholders::error));
+	return;
+    }
+
+    if (!m_active) {
+	m_active = nextEntry();
+	m_received = 0;
+    }
+    sendRequest();
+}
+
+void
+Poller::sendRequest()
+{
+    uint8_t remaining = m_active->length - m_received;
+    std::vector<uint8_t> data(1, remaining);
+    EmsCommandSender::MessagePtr message(new EmsMessage(m_active->address, m_active->type,
+							m_received, data, true));
+    unsigned int busBytes = 2 * FrameOverhead + remaining;
+    long busTime = busBytes * 1000 / BusBytesPerSecond;
+
+    if (Options::statsDebug()) {
+	Options::statsDebug() << boost::format("POLL: reading type 0x%04x from 0x%02x, "
+					       "offset %d, length %d")
+		% m_active->type % (unsigned int) (m_active->address & 0x7f)
+		% m_received % (unsigned int) remaining << std::endl;
+    }
+
+    /* stretch the gap to the next request so polling stays within its share */
+    m_nextSend = boost::posix_time::microsec_clock::universal_time() +
+	    boost::posix_time::milliseconds(busTime * 100 / Options::pollBudget());
+    m_sender.sendMessage(m_client, message);
+}
+
+void
+Poller::onIncomingMessage(const EmsMessage& message)
+{
+    if (!m_active) {
+	return;
+    }
+
+    const EmsMessage::Payload& data = message.getData();
+    bool matches = (message.getSource() & 0x7f) == (m_active->address & 0x7f) &&
+	    message.getType() == m_active->type &&
+	    message.getOffset() == m_received;
+
+    /* the values are handled like those of any other frame, only
+     * whether more data needs to be read matters here */
+    m_received += data.size();
+    if (!matches || data.empty() || m_received >= m_active->length) {
+	finishEntry();
+    } else {
+	scheduleNext();
+    }
+}
+
+void
+Poller::onTimeout()
+{
+    if (!m_active) {
+	return;
+    }
+
+    if (Options::statsDebug()) {
+	Options::statsDebug() << boost::format("POLL: no response for type 0x%04x from 0x%02x")
+		% m_active->type % (unsigned int) (m_active->address & 0x7f) << std::endl;
+    }
+    finishEntry();
+}
+
+void
+Poller::finishEntry()
+{
+    if (m_active->interval != 0) {
+	m_active->due = boost::posix_time::microsec_clock::universal_time() +
+		boost::posix_time::seconds(m_active->interval);
+    } else {
+	m_active->due = boost::posix_time::pos_infin;
+    }
+    m_active = NULL;
+    scheduleNext();
+}
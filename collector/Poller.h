@@ -0,0 +1,99 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLLER_H__
+#define __POLLER_H__
+
+#include <vector>
+#include <boost/asio.hpp>
+#include "CommandScheduler.h"
+#include "EmsMessage.h"
+#include "Noncopyable.h"
+
+/*
+ * Reads types that are only sent on request, so their values reach the
+ * cache and all other outputs like broadcast values do. All known types
+ * are read once after connecting, configured ones again after their
+ * interval. Requests only use the configured share of the bus capacity
+ * and wait while other clients have requests pending.
+ */
+class Poller : private boost::noncopyable
+{
+    public:
+	Poller(boost::asio::io_service& ios, EmsCommandSender& sender);
+	~Poller();
+
+    private:
+	struct Entry {
+	    uint8_t address;
+	    uint16_t type;
+	    uint8_t length;
+	    /* in s, 0 if only read when connecting */
+	    unsigned int interval;
+	    boost::posix_time::ptime due;
+	};
+
+	class PollClient : public EmsCommandClient {
+	    public:
+		PollClient(Poller *poller) :
+		    EmsCommandClient(Background),
+		    m_poller(poller)
+		{}
+		void onIncomingMessage(const EmsMessage& message) override {
+		    m_poller->onIncomingMessage(message);
+		}
+		void onTimeout() override {
+		    m_poller->onTimeout();
+		}
+
+	    private:
+		Poller *m_poller;
+	};
+
+	void onIncomingMessage(const EmsMessage& message);
+	void onTimeout();
+	Entry *nextEntry();
+	void scheduleNext();
+	void handleTimer(const boost::system::error_code& error);
+	void sendRequest();
+	void finishEntry();
+
+    private:
+	/* time for the connection to come up before the first read */
+	static const unsigned int StartDelay = 5; /* s */
+	/* retry delay while other clients use the bus */
+	static const unsigned int BusyDelay = 2; /* s */
+	/* 9600 baud, 8N1 */
+	static const unsigned int BusBytesPerSecond = 960;
+	/* header, checksum and break of a frame, roughly */
+	static const unsigned int FrameOverhead = 8;
+	static const unsigned int DefaultLength = 32;
+
+	EmsCommandSender& m_sender;
+	boost::shared_ptr<EmsCommandClient> m_client;
+	boost::asio::deadline_timer m_timer;
+	std::vector<Entry> m_entries;
+	/* entry being read, NULL if none */
+	Entry *m_active;
+	size_t m_received;
+	/* earliest time for the next request within the bus budget */
+	boost::posix_time::ptime m_nextSend;
+};
+
+#endif /* __POLLER_H__ */
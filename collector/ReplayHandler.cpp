@@ -0,0 +1,114 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include "ReplayHandler.h"
+
+ReplayHandler::ReplayHandler(const std::string& path,
+			     double speed,
+			     ValueCache& cache) :
+    IoHandler(cache),
+    m_path(path),
+    m_reader(path),
+    m_speed(speed),
+    m_timer(*this),
+    m_started(false),
+    m_firstTimestamp(0),
+    m_readCount(0),
+    m_byteCount(0)
+{
+    if (!m_reader.isValid()) {
+	std::cerr << "Failed to open capture file " << path << "." << std::endl;
+	m_active = false;
+	return;
+    }
+
+    readStart();
+}
+
+ReplayHandler::~ReplayHandler()
+{
+    m_timer.cancel();
+}
+
+void
+ReplayHandler::readStart()
+{
+    uint64_t timestamp;
+    size_t length;
+
+    if (!m_active) {
+	return;
+    }
+
+    if (!m_reader.read(timestamp, m_recvBuffer, maxReadLength, length)) {
+	finish();
+	return;
+    }
+
+    if (!m_started) {
+	m_started = true;
+	m_firstTimestamp = timestamp;
+	m_startTime = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    m_readCount++;
+    m_byteCount += length;
+
+    if (m_speed == 0) {
+	/* post instead of calling directly to let other handlers run in between */
+	post(boost::bind(&ReplayHandler::readComplete, this,
+			 boost::system::error_code(), length));
+	return;
+    }
+
+    uint64_t offset = timestamp > m_firstTimestamp ? timestamp - m_firstTimestamp : 0;
+    m_timer.expires_at(m_startTime +
+		       boost::posix_time::microseconds((int64_t) (offset / m_speed)));
+    m_timer.async_wait([this, length] (const boost::system::error_code& error) {
+	if (error != boost::asio::error::operation_aborted) {
+	    readComplete(error, length);
+	}
+    });
+}
+
+void
+ReplayHandler::finish()
+{
+    boost::posix_time::time_duration elapsed =
+	    boost::posix_time::microsec_clock::universal_time() - m_startTime;
+    double seconds = m_started ? elapsed.total_microseconds() / 1000000.0 : 0;
+
+    uint64_t frames = statistics().framesReceived;
+
+    std::cout << "Replay of " << m_path << " finished: " << m_byteCount
+	      << " bytes in " << m_readCount << " reads, " << frames << " frames, "
+	      << seconds << " s";
+    if (seconds > 0) {
+	std::cout << " (" << (uint64_t) (frames / seconds) << " frames/s)";
+    }
+    std::cout << std::endl;
+    close();
+}
+
+void
+ReplayHandler::doCloseImpl()
+{
+    m_timer.cancel();
+}
@@ -0,0 +1,52 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REPLAYHANDLER_H__
+#define __REPLAYHANDLER_H__
+
+#include "BusCapture.h"
+#include "IoHandler.h"
+
+class ReplayHandler : public IoHandler
+{
+    public:
+	/* speed is a multiple of the recorded timing, 0 replays as fast as possible */
+	ReplayHandler(const std::string& path, double speed, ValueCache& cache);
+	~ReplayHandler();
+
+    protected:
+	virtual void readStart();
+	virtual void doCloseImpl();
+
+    private:
+	void finish();
+
+    private:
+	std::string m_path;
+	BusCaptureReader m_reader;
+	double m_speed;
+	boost::asio::deadline_timer m_timer;
+	bool m_started;
+	uint64_t m_firstTimestamp;
+	boost::posix_time::ptime m_startTime;
+	size_t m_readCount;
+	size_t m_byteCount;
+};
+
+#endif /* __REPLAYHANDLER_H__ */
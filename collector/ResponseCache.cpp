@@ -0,0 +1,103 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ResponseCache.h"
+
+unsigned int
+ResponseCache::lifetime(uint16_t type)
+{
+    switch (type) {
+	case 0x0002: /* version */
+	case 0x0137: /* contact info */
+	    return 3600;
+	case 0x0015: /* maintenance settings */
+	case 0x00ea: /* WW parameters */
+	case 0x0140: /* system parameters */
+	case 0x01af: /* HK parameters */
+	case 0x01b9: /* HK configuration */
+	case 0x01f5: /* WW configuration */
+	    return 60;
+    }
+    return DefaultLifetime;
+}
+
+bool
+ResponseCache::lookup(uint8_t address, uint16_t type, uint8_t offset, uint8_t length,
+		      std::vector<uint8_t>& data)
+{
+    auto iter = m_entries.find(Key(address & 0x7f, type, offset, length));
+    if (iter == m_entries.end()) {
+	return false;
+    }
+    if (iter->second.expiry <= boost::posix_time::microsec_clock::universal_time()) {
+	m_entries.erase(iter);
+	return false;
+    }
+
+    data = iter->second.data;
+    return true;
+}
+
+void
+ResponseCache::store(uint8_t address, uint16_t type, uint8_t offset, uint8_t length,
+		     const EmsMessage::Payload& data)
+{
+    Entry& entry = m_entries[Key(address & 0x7f, type, offset, length)];
+
+    entry.data.assign(data.begin(), data.end());
+    entry.expiry = boost::posix_time::microsec_clock::universal_time() +
+	    boost::posix_time::seconds(lifetime(type));
+}
+
+void
+ResponseCache::invalidate(uint8_t address, uint16_t type, size_t offset, size_t length)
+{
+    auto iter = m_entries.lower_bound(Key(address & 0x7f, type, 0, 0));
+
+    while (iter != m_entries.end() && std::get<0>(iter->first) == (address & 0x7f) &&
+	    std::get<1>(iter->first) == type) {
+	size_t entryOffset = std::get<2>(iter->first);
+	size_t entryLength = std::get<3>(iter->first);
+
+	if (entryOffset < offset + length && offset < entryOffset + entryLength) {
+	    iter = m_entries.erase(iter);
+	} else {
+	    ++iter;
+	}
+    }
+}
+
+void
+ResponseCache::handleFrame(const EmsMessage& message)
+{
+    uint8_t dest = message.getDestination();
+    size_t length = message.getData().size();
+
+    /* answers to our own reads are stored by the reader */
+    if (m_entries.empty() || length == 0 || (dest | 0x80) == EmsProto::addressPC) {
+	return;
+    }
+
+    /* broadcasts carry registers of the source, writes those of the
+     * destination; read requests of other devices just drop a bit more */
+    invalidate(message.getSource(), message.getType(), message.getOffset(), length);
+    if ((dest & 0x7f) != 0) {
+	invalidate(dest, message.getType(), message.getOffset(), length);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Buderus EMS data collector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RESPONSECACHE_H__
+#define __RESPONSECACHE_H__
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "EmsMessage.h"
+#include "Noncopyable.h"
+
+/*
+ * Recent answers to read requests, so repeated reads of rarely changing
+ * registers don't need a bus transaction. Entries expire after a per-type
+ * lifetime and are dropped as soon as a write or broadcast touching
+ * their register range is seen.
+ */
+class ResponseCache : private boost::noncopyable
+{
+    public:
+	bool lookup(uint8_t address, uint16_t type, uint8_t offset, uint8_t length,
+		    std::vector<uint8_t>& data);
+	void store(uint8_t address, uint16_t type, uint8_t offset, uint8_t length,
+		   const EmsMessage::Payload& data);
+	void invalidate(uint8_t address, uint16_t type, size_t offset, size_t length);
+	void handleFrame(const EmsMessage& message);
+
+    private:
+	static unsigned int lifetime(uint16_t type);
+
+    private:
+	/* address without read bit, type, offset, requested length */
+	typedef std::tuple<uint8_t, uint16_t, uint8_t, uint8_t> Key;
+	struct Entry {
+	    std::vector<uint8_t> data;
+	    boost::posix_time::ptime expiry;
+	};
+
+	static const unsigned int DefaultLifetime = 2; /* s */
+
+	std::map<Key, Entry> m_entries;
+};
+
+#endif /* __RESPONSECACHE_H__ */
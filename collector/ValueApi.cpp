@@ -17,10 +17,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
 #include <map>
 #include <sstream>
 #include <boost/format.hpp>
 #include "ApiCommandParser.h"
+#include "ByteOrder.h"
 #include "ValueApi.h"
 
 std::string
@@ -378,3 +380,126 @@ ValueApi::formatValue(const EmsValue& value)
 
     return stream.str();
 }
+
+static void
+appendLe(std::string& out, uint32_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+	out.push_back((char) (value >> (8 * i)));
+    }
+}
+
+static void
+appendDateTime(std::string& out, const EmsProto::DateTimeRecord& record)
+{
+    out.push_back((char) record.year);
+    out.push_back((char) record.month);
+    out.push_back((char) record.day);
+    out.push_back((char) record.hour);
+    out.push_back((char) record.minute);
+    out.push_back(record.valid ? 1 : 0);
+}
+
+std::string
+ValueApi::formatRawValue(const EmsValue& value)
+{
+    std::string payload;
+
+    if (!value.isValid()) {
+	return payload;
+    }
+
+    switch (value.getReadingType()) {
+	case EmsValue::Numeric: {
+	    float reading = value.getValue<float>();
+	    uint32_t bits;
+	    memcpy(&bits, &reading, sizeof(bits));
+	    appendLe(payload, bits, 4);
+	    break;
+	}
+	case EmsValue::Integer:
+	    appendLe(payload, value.getValue<unsigned int>(), 4);
+	    break;
+	case EmsValue::Boolean:
+	    payload.push_back(value.getValue<bool>() ? 1 : 0);
+	    break;
+	case EmsValue::Enumeration:
+	    payload.push_back((char) value.getValue<uint8_t>());
+	    break;
+	case EmsValue::Kennlinie: {
+	    const std::vector<uint8_t>& points = value.getValue<std::vector<uint8_t> >();
+	    payload.assign(points.begin(), points.end());
+	    break;
+	}
+	case EmsValue::Error: {
+	    const EmsValue::ErrorEntry& entry = value.getValue<EmsValue::ErrorEntry>();
+	    appendLe(payload, entry.type, 2);
+	    payload.push_back((char) entry.index);
+	    payload.push_back((char) entry.record.errorAscii[0]);
+	    payload.push_back((char) entry.record.errorAscii[1]);
+	    appendLe(payload, BE16_TO_CPU(entry.record.code_be16), 2);
+	    appendDateTime(payload, entry.record.time);
+	    appendLe(payload, BE16_TO_CPU(entry.record.durationMinutes_be16), 2);
+	    payload.push_back((char) entry.record.source);
+	    break;
+	}
+	case EmsValue::Date: {
+	    const EmsProto::DateRecord& record = value.getValue<EmsProto::DateRecord>();
+	    payload.push_back((char) record.year);
+	    payload.push_back((char) record.month);
+	    payload.push_back((char) record.day);
+	    break;
+	}
+	case EmsValue::SystemTime: {
+	    const EmsProto::SystemTimeRecord& record = value.getValue<EmsProto::SystemTimeRecord>();
+	    appendDateTime(payload, record.common);
+	    payload.push_back((char) record.second);
+	    payload.push_back((char) record.dayOfWeek);
+	    payload.push_back((char) ((record.running ? 0x01 : 0) | (record.dcf ? 0x02 : 0) |
+				      (record.dst ? 0x04 : 0)));
+	    break;
+	}
+	case EmsValue::Formatted:
+	    payload = value.getValue<std::string>();
+	    break;
+    }
+
+    return payload;
+}
+
+std::string
+ValueApi::formatJsonValue(const EmsValue& value)
+{
+    switch (value.getReadingType()) {
+	case EmsValue::Numeric:
+	case EmsValue::Integer:
+	    return value.isValid() ? formatValue(value) : "null";
+	case EmsValue::Boolean:
+	    return value.getValue<bool>() ? "true" : "false";
+	default:
+	    return formatJsonString(formatValue(value));
+    }
+}
+
+std::string
+ValueApi::formatJsonString(const std::string& text)
+{
+    static const char *hex = "0123456789abcdef";
+    std::string result = "\"";
+
+    for (char c : text) {
+	if (c == '"' || c == '\\') {
+	    result += '\\';
+	    result += c;
+	} else if ((unsigned char) c < 0x20) {
+	    result += "\\u00";
+	    result += hex[(c >> 4) & 0xf];
+	    result += hex[c & 0xf];
+	} else {
+	    result += c;
+	}
+    }
+    result += '"';
+
+    return result;
+}
@@ -26,6 +26,27 @@ namespace ValueApi {
     std::string getTypeName(EmsValue::Type type);
     std::string getSubTypeName(EmsValue::SubType subtype);
     std::string formatValue(const EmsValue& value);
+    /* Multi-byte fields are little endian. Invalid (unavailable) values of
+     * any type are sent as empty payload, otherwise:
+     * - numeric: 4 byte IEEE float
+     * - integer: 4 byte unsigned
+     * - boolean, enumeration: 1 byte
+     * - kennlinie: 1 byte per point
+     * - date: 1 byte each year (since 2000), month, day
+     * - system time: date time, 1 byte each second, day of week, flags
+     *   (bit 0 running, bit 1 DCF, bit 2 DST)
+     * - error: 2 byte type, 1 byte index, 2 byte ASCII error code,
+     *   2 byte numeric code, date time, 2 byte duration in minutes,
+     *   1 byte source
+     * - formatted: string without terminator
+     * where date time is 1 byte each year (since 2000), month, day,
+     * hour, minute and valid flag */
+    std::string formatRawValue(const EmsValue& value);
+    /* quoted and escaped for use in JSON documents */
+    std::string formatJsonString(const std::string& text);
+    /* numbers and booleans as JSON literals (null if unavailable),
+     * everything else as formatted string */
+    std::string formatJsonValue(const EmsValue& value);
 }
 
 #endif /* __DATAHANDLER_H__ */
@@ -17,69 +17,266 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include "Options.h"
 #include "ValueApi.h"
 #include "ValueCache.h"
 
-ValueCache::ValueCache()
+ValueCache::ValueCache() :
+    m_slots(EmsValue::TypeLast * EmsValue::SubTypeLast),
+    m_metricPrefixes(m_slots.size())
 {
+    for (size_t type = 0; type < EmsValue::TypeLast; type++) {
+	std::string typeName = ValueApi::getTypeName((EmsValue::Type) type);
+	if (typeName.empty()) {
+	    continue;
+	}
+	for (size_t subtype = 0; subtype < EmsValue::SubTypeLast; subtype++) {
+	    std::string subtypeName = ValueApi::getSubTypeName((EmsValue::SubType) subtype);
+	    std::string& prefix = m_metricPrefixes[slotIndex((EmsValue::Type) type,
+							     (EmsValue::SubType) subtype)];
+
+	    prefix = "ems_value{";
+	    if (!subtypeName.empty()) {
+		prefix += "subtype=\"" + subtypeName + "\",";
+	    }
+	    prefix += "type=\"" + typeName + "\"} ";
+	}
+    }
 }
 
 ValueCache::~ValueCache()
 {
 }
 
+bool
+ValueCache::setSnapshotFile(const std::string& path)
+{
+    m_snapshot.reset(new CacheSnapshot(path, m_slots.size()));
+    if (!m_snapshot->isValid()) {
+	m_snapshot.reset();
+	return false;
+    }
+
+    m_snapshot->restore([this] (time_t timestamp, const EmsValue& value) {
+	update(m_slots[slotIndex(value.getType(), value.getSubType())], timestamp, value, true);
+    });
+
+    return true;
+}
+
 void
 ValueCache::handleValue(const EmsValue& value)
 {
-    CacheKey key(value.getType(), value.getSubType());
-    m_cache.erase(key);
-    m_cache.insert(std::make_pair(key, CacheEntry(value)));
+    size_t index = slotIndex(value.getType(), value.getSubType());
+    Slot& slot = m_slots[index];
+    time_t now = time(NULL);
+
+    update(slot, now, value, false);
+
+    if (m_snapshot) {
+	m_snapshot->store(index, now, value);
+    }
+
+    size_t historySize = Options::cacheHistorySize();
+    if (historySize > 0) {
+	if (!slot.history) {
+	    slot.history.reset(new History(historySize));
+	}
+	slot.history->add(now, value);
+    }
+}
+
+void
+ValueCache::update(Slot& slot, time_t timestamp, const EmsValue& value, bool restored)
+{
+    CacheSnapshot::Record record;
+    uint64_t words[RecordWords];
+
+    /* values too large for a record are only visible to the io thread */
+    memset(&record, 0, sizeof(record));
+    record.used = CacheSnapshot::encode(value, record) ? 1 : 0;
+    record.type = value.getType();
+    record.subType = value.getSubType();
+    record.timestamp = timestamp;
+    memcpy(words, &record, sizeof(record));
+
+    /* only allocates when the key is seen first */
+    if (!slot.value) {
+	slot.value.reset(new EmsValue(value));
+    } else {
+	*slot.value = value;
+    }
+
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < RecordWords; i++) {
+	slot.record[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.restored.store(restored, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+ValueCache::EntryPtr
+ValueCache::readEntry(const Slot& slot)
+{
+    CacheSnapshot::Record record;
+    uint64_t words[RecordWords];
+    uint32_t sequence;
+    bool restored;
+
+    do {
+	sequence = slot.sequence.load(std::memory_order_acquire);
+	for (size_t i = 0; i < RecordWords; i++) {
+	    words[i] = slot.record[i].load(std::memory_order_relaxed);
+	}
+	restored = slot.restored.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) != 0 || slot.sequence.load(std::memory_order_relaxed) != sequence);
+
+    if (sequence == 0) {
+	return EntryPtr();
+    }
+
+    EmsValue::Reading reading;
+    memcpy(&record, words, sizeof(record));
+    if (!record.used || !CacheSnapshot::decode(record, reading)) {
+	return EntryPtr();
+    }
+
+    EmsValue value((EmsValue::Type) record.type, (EmsValue::SubType) record.subType,
+		   (EmsValue::ReadingType) record.readingType, reading, record.valid != 0);
+    std::shared_ptr<CacheEntry> entry = std::make_shared<CacheEntry>(value);
+    entry->timestamp = (time_t) record.timestamp;
+    entry->restored = restored;
+    return entry;
 }
 
 const EmsValue *
 ValueCache::getValue(EmsValue::Type type, EmsValue::SubType subtype) const
 {
-    auto iter = m_cache.find(CacheKey(type, subtype));
-    if (iter == m_cache.end()) {
-	return NULL;
-    }
-    return &iter->second.value;
+    return m_slots[slotIndex(type, subtype)].value.get();
+}
+
+ValueCache::EntryPtr
+ValueCache::getEntry(EmsValue::Type type, EmsValue::SubType subtype) const
+{
+    return readEntry(m_slots[slotIndex(type, subtype)]);
 }
 
 void
 ValueCache::outputValues(const std::vector<std::string>& selector, std::ostream& stream)
 {
-    for (auto& entry: m_cache) {
-	std::string type = ValueApi::getTypeName(entry.first.m_type);
-	if (type.empty()) {
+    for (auto& slot: m_slots) {
+	EntryPtr entry = readEntry(slot);
+	if (!entry) {
 	    continue;
 	}
 
-	std::string subtype = ValueApi::getSubTypeName(entry.first.m_subtype);
-	bool matchesSelector = false;
-
-	if (selector.size() >= 1) {
-	    if (selector[0] == type) {
-		matchesSelector = true;
-	    } else if (selector[0] == subtype || (selector[0] == "none" && subtype.empty())) {
-		if (selector.size() == 1) {
-		    matchesSelector = true;
-		} else if (selector[1] == type) {
-		    matchesSelector = true;
-		}
-	    }
-	} else {
-	    // no selector matches everything
-	    matchesSelector = true;
+	std::string type = ValueApi::getTypeName(entry->value.getType());
+	if (type.empty()) {
+	    continue;
 	}
-	if (!matchesSelector) {
+
+	std::string subtype = ValueApi::getSubTypeName(entry->value.getSubType());
+	if (!matchesSelector(selector, type, subtype)) {
 	    continue;
 	}
 
 	if (!subtype.empty()) {
 	    stream << subtype << " ";
 	}
-	stream << type << " = " << ValueApi::formatValue(entry.second.value);
-	stream << " | " << entry.second.timestamp << '\n';
+	stream << type << " = " << ValueApi::formatValue(entry->value);
+	stream << " | " << entry->timestamp;
+	if (entry->restored) {
+	    stream << " | restored";
+	}
+	stream << '\n';
+    }
+}
+
+void
+ValueCache::outputMetrics(std::ostream& stream) const
+{
+    stream << "# TYPE ems_value gauge\n";
+    stream << "# HELP ems_value Last value received from the bus\n";
+
+    for (size_t i = 0; i < m_slots.size(); i++) {
+	const EmsValue *value = m_slots[i].value.get();
+	if (!value || !value->isValid() || m_metricPrefixes[i].empty()) {
+	    continue;
+	}
+
+	switch (value->getReadingType()) {
+	    case EmsValue::Numeric:
+		stream << m_metricPrefixes[i] << value->getValue<float>() << '\n';
+		break;
+	    case EmsValue::Integer:
+		stream << m_metricPrefixes[i] << value->getValue<unsigned int>() << '\n';
+		break;
+	    case EmsValue::Boolean:
+		stream << m_metricPrefixes[i] << (value->getValue<bool>() ? 1 : 0) << '\n';
+		break;
+	    default:
+		break;
+	}
+    }
+}
+
+void
+ValueCache::outputHistory(const std::vector<std::string>& selector, size_t count,
+			  time_t since, std::ostream& stream)
+{
+    for (auto& slot: m_slots) {
+	if (!slot.history || slot.history->size() == 0) {
+	    continue;
+	}
+
+	const History& history = *slot.history;
+	const EmsValue& latest = history[history.size() - 1].value;
+	std::string type = ValueApi::getTypeName(latest.getType());
+	if (type.empty()) {
+	    continue;
+	}
+
+	std::string subtype = ValueApi::getSubTypeName(latest.getSubType());
+	if (!matchesSelector(selector, type, subtype)) {
+	    continue;
+	}
+
+	size_t start = 0;
+	if (count != 0 && history.size() > count) {
+	    start = history.size() - count;
+	}
+	for (size_t i = start; i < history.size(); i++) {
+	    const History::Entry& entry = history[i];
+	    if (entry.timestamp < since) {
+		continue;
+	    }
+	    if (!subtype.empty()) {
+		stream << subtype << " ";
+	    }
+	    stream << type << " = " << ValueApi::formatValue(entry.value);
+	    stream << " | " << entry.timestamp << '\n';
+	}
+    }
+}
+
+bool
+ValueCache::matchesSelector(const std::vector<std::string>& selector,
+			    const std::string& type, const std::string& subtype)
+{
+    if (selector.empty()) {
+	// no selector matches everything
+	return true;
+    }
+
+    if (selector[0] == type) {
+	return true;
+    }
+    if (selector[0] == subtype || (selector[0] == "none" && subtype.empty())) {
+	return selector.size() == 1 || selector[1] == type;
     }
+    return false;
 }
@@ -21,49 +21,126 @@
 #define __VALUECACHE_H__
 
 #include <time.h>
-#include <map>
+#include <atomic>
+#include <memory>
 #include <ostream>
 #include <vector>
+#include <boost/scoped_ptr.hpp>
+#include "CacheSnapshot.h"
 #include "EmsMessage.h"
 
 class ValueCache
 {
+    public:
+	struct CacheEntry {
+	    time_t timestamp;
+	    EmsValue value;
+	    /* loaded from the snapshot file, not yet seen on the bus */
+	    bool restored;
+
+	    CacheEntry(const EmsValue& v) :
+		timestamp(time(NULL)), value(v), restored(false) { }
+	};
+	typedef std::shared_ptr<const CacheEntry> EntryPtr;
+
     public:
 	ValueCache();
 	~ValueCache();
 
+	/* mirrors the cache into the given file, restoring its contents first */
+	bool setSnapshotFile(const std::string& path);
+
+	/* handleValue and getValue must be called from the io thread,
+	 * the returned value is updated in place by handleValue */
 	void handleValue(const EmsValue& value);
-	void outputValues(const std::vector<std::string>& selector, std::ostream& stream);
 	const EmsValue * getValue(EmsValue::Type type, EmsValue::SubType subtype) const;
 
+	/* safe to call from any thread and never block handleValue; the
+	 * returned entry is a copy, retried while a concurrent update of
+	 * the same value is in progress */
+	void outputValues(const std::vector<std::string>& selector, std::ostream& stream);
+	EntryPtr getEntry(EmsValue::Type type, EmsValue::SubType subtype) const;
+
+	/* io thread only; outputs at most count (0 = all) values per key
+	 * received at or after since, oldest first */
+	void outputHistory(const std::vector<std::string>& selector, size_t count,
+			   time_t since, std::ostream& stream);
+
+	/* io thread only; numeric, integer and boolean values as OpenMetrics
+	 * gauge family ems_value, without the terminating # EOF */
+	void outputMetrics(std::ostream& stream) const;
+
+	/* selector is [type], [subtype] or [subtype, type], empty matches all */
+	static bool matchesSelector(const std::vector<std::string>& selector,
+				    const std::string& type, const std::string& subtype);
+
     private:
-	class CacheKey {
+	/* fixed capacity ring of the last values of one key, allocated
+	 * in full when the key is seen first */
+	class History {
 	    public:
-		CacheKey(EmsValue::Type type, EmsValue::SubType subtype) :
-		    m_type(type), m_subtype(subtype) { }
-		bool operator=(const CacheKey& rhs) {
-		    return m_type == rhs.m_type && m_subtype == rhs.m_subtype;
+		struct Entry {
+		    time_t timestamp;
+		    EmsValue value;
+		};
+
+		History(size_t capacity) :
+		    m_capacity(capacity), m_next(0) {
+		    m_entries.reserve(capacity);
 		}
-		bool operator<(const CacheKey& rhs) const {
-		    if (m_type != rhs.m_type) {
-			return m_type < rhs.m_type;
+
+		void add(time_t timestamp, const EmsValue& value) {
+		    if (m_entries.size() < m_capacity) {
+			m_entries.push_back(Entry { timestamp, value });
+		    } else {
+			m_entries[m_next].timestamp = timestamp;
+			m_entries[m_next].value = value;
 		    }
-		    return m_subtype < rhs.m_subtype;
+		    m_next = (m_next + 1) % m_capacity;
+		}
+		size_t size() const {
+		    return m_entries.size();
+		}
+		/* 0 is the oldest entry */
+		const Entry& operator[](size_t index) const {
+		    size_t start = m_entries.size() < m_capacity ? 0 : m_next;
+		    return m_entries[(start + index) % m_capacity];
 		}
 
-		EmsValue::Type m_type;
-		EmsValue::SubType m_subtype;
+	    private:
+		std::vector<Entry> m_entries;
+		size_t m_capacity;
+		size_t m_next;
 	};
 
-	struct CacheEntry {
-	    time_t timestamp;
-	    EmsValue value;
+	static const size_t RecordWords = sizeof(CacheSnapshot::Record) / sizeof(uint64_t);
 
-	    CacheEntry(const EmsValue& v) :
-		timestamp(time(NULL)), value(v) { }
+	/* Each slot holds the value twice: the io thread copy returned by
+	 * getValue, and the value encoded as snapshot record for the other
+	 * threads. The record is guarded by a sequence lock: the sequence is
+	 * odd while handleValue rewrites it, readers copy it and retry when
+	 * the sequence changed meanwhile. The record is copied word by word
+	 * through relaxed atomics, so readers and writer never race. */
+	struct Slot {
+	    Slot() : sequence(0), restored(false) { }
+
+	    std::unique_ptr<EmsValue> value;
+	    std::atomic<uint32_t> sequence;
+	    std::atomic<uint64_t> record[RecordWords];
+	    std::atomic<bool> restored;
+	    std::unique_ptr<History> history;
 	};
 
-	std::map<CacheKey, CacheEntry> m_cache;
+	static size_t slotIndex(EmsValue::Type type, EmsValue::SubType subtype) {
+	    return type * EmsValue::SubTypeLast + subtype;
+	}
+	static void update(Slot& slot, time_t timestamp, const EmsValue& value, bool restored);
+	static EntryPtr readEntry(const Slot& slot);
+
+	std::vector<Slot> m_slots;
+	/* 'ems_value{...} ' per slot, empty for keys without name */
+	std::vector<std::string> m_metricPrefixes;
+	boost::scoped_ptr<CacheSnapshot> m_snapshot;
 };
 
 #endif /* __VALUECACHE_H__ */
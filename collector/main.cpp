@@ -22,6 +22,7 @@
 #include <iostream>
 #include <boost/asio/signal_set.hpp>
 #include <boost/bind/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
 #include "CommandHandler.h"
 #include "CommandScheduler.h"
@@ -29,9 +30,12 @@
 # include "Database.h"
 #endif
 #include "DataHandler.h"
+#include "HttpHandler.h"
 #include "MqttAdapter.h"
 #include "Options.h"
 #include "PidFile.h"
+#include "Poller.h"
+#include "ReplayHandler.h"
 #include "SendingSerialHandler.h"
 #include "SerialHandler.h"
 #include "TcpHandler.h"
@@ -51,6 +55,30 @@ getHandler(const std::string& target, ValueCache& cache)
 	    std::string port = target.substr(pos + 1);
 	    return new TcpHandler(host, port, cache);
 	}
+    } else if (target.compare(0, 7, "replay:") == 0) {
+	std::string path = target.substr(7);
+	double speed = 1;
+	size_t pos = path.find(",speed=");
+	if (pos != std::string::npos) {
+	    std::string speedSpec = path.substr(pos + 7);
+	    path.erase(pos);
+	    if (speedSpec == "max") {
+		speed = 0;
+	    } else {
+		if (speedSpec.empty() || speedSpec[speedSpec.size() - 1] != 'x') {
+		    return nullptr;
+		}
+		try {
+		    speed = boost::lexical_cast<double>(speedSpec.substr(0, speedSpec.size() - 1));
+		} catch (boost::bad_lexical_cast& e) {
+		    return nullptr;
+		}
+		if (speed <= 0) {
+		    return nullptr;
+		}
+	    }
+	}
+	return new ReplayHandler(path, speed, cache);
     }
 
     return nullptr;
@@ -98,6 +126,10 @@ int main(int argc, char *argv[])
 	ValueCache cache;
 	bool running = true;
 
+	if (!Options::cacheFile().empty()) {
+	    cache.setSnapshotFile(Options::cacheFile());
+	}
+
 #ifdef HAVE_DAEMONIZE
 	PidFile pid(Options::pidFilePath());
 	if (Options::daemonize()) {
@@ -132,6 +164,10 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+#ifdef HAVE_MYSQL
+	db.start();
+#endif
+
 	IoHandler::ValueCallback cacheValueCb =
 		boost::bind(&ValueCache::handleValue, &cache, boost::placeholders::_1);
 
@@ -149,12 +185,21 @@ int main(int argc, char *argv[])
 	    handler->addValueCallback(cacheValueCb);
 
 	    EmsCommandSender *sender = dynamic_cast<EmsCommandSender *>(handler.get());
+	    if (sender) {
+		IoHandler::FrameCallback frameCb =
+			boost::bind(&ResponseCache::handleFrame, &sender->responseCache(),
+				    boost::placeholders::_1);
+		handler->addFrameCallback(frameCb);
+	    }
 	    boost::scoped_ptr<MqttAdapter> mqttAdapter(
 		    getMqttAdapter(*handler, sender, Options::mqttTarget()));
 	    if (mqttAdapter) {
 		IoHandler::ValueCallback valueCb =
 			boost::bind(&MqttAdapter::handleValue, mqttAdapter.get(), boost::placeholders::_1);
 		handler->addValueCallback(valueCb);
+		IoHandler::FrameCallback frameCb =
+			boost::bind(&MqttAdapter::handleFrame, mqttAdapter.get(), boost::placeholders::_1);
+		handler->addFrameCallback(frameCb);
 	    }
 
 	    boost::scoped_ptr<CommandHandler> cmdHandler;
@@ -164,22 +209,42 @@ int main(int argc, char *argv[])
 		cmdHandler.reset(new CommandHandler(*handler, *sender, &cache, cmdEndpoint));
 	    }
 
+	    boost::scoped_ptr<Poller> poller;
+	    if (sender && Options::pollEnabled()) {
+		poller.reset(new Poller(*handler, *sender));
+	    }
+
 	    boost::scoped_ptr<DataHandler> dataHandler;
 	    unsigned int dataPort = Options::dataPort();
 	    if (dataPort != 0) {
 		boost::asio::ip::tcp::endpoint dataEndpoint(boost::asio::ip::tcp::v4(), dataPort);
-		dataHandler.reset(new DataHandler(*handler, dataEndpoint));
+		dataHandler.reset(new DataHandler(*handler, &cache, dataEndpoint));
 		IoHandler::ValueCallback valueCb =
 			boost::bind(&DataHandler::handleValue, dataHandler.get(), boost::placeholders::_1);
 		handler->addValueCallback(valueCb);
 	    }
 
+	    boost::scoped_ptr<HttpHandler> httpHandler;
+	    unsigned int httpPort = Options::httpPort();
+	    if (httpPort != 0) {
+		boost::asio::ip::tcp::endpoint httpEndpoint(boost::asio::ip::tcp::v4(), httpPort);
+		httpHandler.reset(new HttpHandler(*handler, &cache, httpEndpoint));
+		IoHandler::ValueCallback valueCb =
+			boost::bind(&HttpHandler::handleValue, httpHandler.get(), boost::placeholders::_1);
+		handler->addValueCallback(valueCb);
+	    }
+
 	    boost::asio::signal_set signals(*handler);
 	    fillSignalSet(signals);
 	    signals.async_wait(boost::bind(&stopHandler, handler.get(), &running));
 
 	    handler->run();
 
+	    /* a replay is done once the capture was fed through */
+	    if (Options::target().compare(0, 7, "replay:") == 0) {
+		running = false;
+	    }
+
 	    /* wait some time until retrying */
 	    if (running) {
 		boost::asio::io_service ios;
@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+#
+# Generates a synthetic bus capture (see collector/BusCapture.h) of UBA2
+# and UI800 traffic with interleaved noise, for benchmarking the parser:
+#
+#   ems-gen-capture.py capture.bin [frames]
+#   collectord -f replay:capture.bin,speed=max
+#
+# The replay prints the number of frames and frames per second when done.
+import random
+import struct
+import sys
+import time
+
+READ_SIZE = 512
+
+def frame(source, dest, type, offset, payload):
+    if type >= 0xf0:
+        header = [source, dest, 0xff, offset, type >> 8, type & 0xff]
+    else:
+        header = [source, dest, type, offset]
+    data = bytes(header + payload)
+    checksum = 0
+    for b in data:
+        checksum ^= b
+    return bytes([0xaa, 0x55, len(data)]) + data + bytes([checksum])
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write("Usage: %s <capture file> [frames]\n" % sys.argv[0])
+        return 1
+
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200000
+    rand = random.Random(0)
+    templates = [
+        (0x88, 0x00, 0xe4, 46),     # UBA2 monitor
+        (0x88, 0x00, 0xe5, 40),     # UBA2 monitor 2
+        (0x88, 0x00, 0xd1, 2),      # outdoor temperature
+        (0x90, 0x00, 0x01a5, 46),   # UI800 HK status
+        (0x90, 0x00, 0x021d, 10),   # UI800 WW status
+    ]
+
+    stream = bytearray()
+    for i in range(count):
+        source, dest, type, length = rand.choice(templates)
+        # keep the frame within the one byte length field
+        length = min(length, 255 - 6)
+        payload = [rand.randrange(256) for _ in range(length)]
+        stream += frame(source, dest, type, 0, payload)
+        if i % 16 == 0:
+            # no 0xaa in the noise, so every generated frame is found
+            stream += bytes(rand.randrange(0xa0) for _ in range(rand.randrange(8)))
+
+    timestamp = int(time.time() * 1000000)
+    with open(sys.argv[1], "wb") as f:
+        f.write(b"EMSCAP" + bytes([1]))
+        for pos in range(0, len(stream), READ_SIZE):
+            chunk = stream[pos:pos + READ_SIZE]
+            f.write(struct.pack("<QH", timestamp, len(chunk)))
+            f.write(chunk)
+            timestamp += 1000
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())